@@ -0,0 +1,396 @@
+//Written by David Ells
+//
+//A compact binary tree ADT. See ctree.h.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "ctree.h"
+
+void ctreenode_init(ctreenode *n, int value)
+{
+    n->value = value;
+    n->left = CTREE_NIL;
+    n->right = CTREE_NIL;
+}
+
+int ctreenode_isleaf(ctreenode *n)
+{
+    return (n->left == CTREE_NIL && n->right == CTREE_NIL);
+}
+
+int ctreenode_isblock(ctreenode *n)
+{
+    return (n->left == CTREE_BLOCK);
+}
+
+void ctreenode_print(ctree *t, uint32_t i, FILE *f)
+{
+    uint32_t left = ctree_left(t, i);
+    uint32_t right = ctree_right(t, i);
+
+    fprintf(f, "node %u:", i);
+    if(left != CTREE_NIL)
+        fprintf(f, " left:%u", left);
+    if(right != CTREE_NIL)
+        fprintf(f, " right:%u", right);
+    fprintf(f, "\n");
+}
+
+
+void ctree_init(ctree *t)
+{
+    t->nodes = NULL;
+    t->head = CTREE_NIL;
+    t->node_count = 0;
+    t->blocks = NULL;
+    t->block_count = 0;
+    t->block_values = NULL;
+    t->block_ids = NULL;
+    t->map = NULL;
+    t->map_len = 0;
+}
+
+//Allocate the node arena in one piece. Returns 0 on failure.
+int ctree_alloc(ctree *t, unsigned long node_count)
+{
+    if(node_count > CTREE_MAX_NODES) return 0;
+
+    t->nodes = (ctreenode *)malloc(sizeof(ctreenode) * node_count);
+    if(t->nodes == NULL) return 0;
+    t->node_count = node_count;
+    return 1;
+}
+
+void ctree_free(ctree *t)
+{
+    if(t->map != NULL){
+        munmap(t->map, t->map_len);
+    } else {
+        free(t->nodes);
+        free(t->blocks);
+        free(t->block_values);
+        free(t->block_ids);
+    }
+    ctree_init(t);
+}
+
+//Round an image offset up to the next section boundary.
+static uint64_t image_align(uint64_t off)
+{
+    return (off + CTREE_IMAGE_ALIGN - 1) / CTREE_IMAGE_ALIGN * CTREE_IMAGE_ALIGN;
+}
+
+//Append len bytes of data to an image, padded to the next section
+//boundary. Returns 0 on success.
+static int image_write(FILE *f, const void *data, uint64_t len)
+{
+    static const char zeros[CTREE_IMAGE_ALIGN];
+    uint64_t pad = image_align(len) - len;
+
+    if(len > 0 && fwrite(data, 1, len, f) != len) return -1;
+    if(pad > 0 && fwrite(zeros, 1, pad, f) != pad) return -1;
+    return 0;
+}
+
+//Write t, leaf blocks and all, to the image file fname. Returns 0 on
+//success, else -1 with errno set.
+int ctree_save(ctree *t, const char *fname)
+{
+    ctree_image_header h;
+    FILE *f;
+    int err = 0;
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, CTREE_IMAGE_MAGIC, CTREE_IMAGE_MAGIC_LEN);
+    h.byte_order = CTREE_IMAGE_BYTE_ORDER;
+    h.head = t->head;
+    h.node_count = t->node_count;
+    h.block_count = t->block_count;
+    h.block_value_count = (t->block_count == 0) ? 0 :
+        (uint64_t)t->blocks[t->block_count-1].offset + t->blocks[t->block_count-1].length;
+
+    if((f = fopen(fname, "wb")) == NULL) return -1;
+    if(image_write(f, &h, sizeof(h)) != 0 ||
+       image_write(f, t->nodes, sizeof(ctreenode) * h.node_count) != 0 ||
+       image_write(f, t->blocks, sizeof(ctreeblock) * h.block_count) != 0 ||
+       image_write(f, t->block_values, sizeof(int) * h.block_value_count) != 0 ||
+       image_write(f, t->block_ids, sizeof(uint32_t) * h.block_value_count) != 0)
+        err = errno;
+    if(fclose(f) != 0 && err == 0) err = errno;
+    if(err != 0){
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+//Check the links of a mapped image: every child and block id names a
+//node, every block lies inside the value_count block values, and no node
+//has two parents or is the head's child, so a search of it ends.
+//Returns 0 if so, else -1 with errno set (EINVAL for a bad image).
+static int image_check(ctree *t, uint64_t value_count)
+{
+    unsigned char *has_parent;
+    uint32_t i, links[2];
+    uint64_t j;
+    ctreeblock *blk;
+    int k, bad = 0;
+
+    has_parent = (unsigned char *)calloc(t->node_count / 8 + 1, 1);
+    if(has_parent == NULL) return -1;
+    if(t->node_count > 0) has_parent[t->head / 8] |= 1 << (t->head % 8);
+
+    for(i = 0; i < t->node_count && !bad; i++){
+        if(ctreenode_isblock(&t->nodes[i])){
+            if(t->nodes[i].right >= t->block_count){
+                bad = 1;
+                break;
+            }
+        }
+        links[0] = ctree_left(t, i);
+        links[1] = ctree_right(t, i);
+        for(k = 0; k < 2; k++){
+            if(links[k] == CTREE_NIL) continue;
+            if(links[k] >= t->node_count ||
+               (has_parent[links[k] / 8] & (1 << (links[k] % 8)))){
+                bad = 1;
+                break;
+            }
+            has_parent[links[k] / 8] |= 1 << (links[k] % 8);
+        }
+    }
+    for(i = 0; i < t->block_count && !bad; i++){
+        blk = &t->blocks[i];
+        if(blk->length == 0 || (uint64_t)blk->offset + blk->length > value_count)
+            bad = 1;
+    }
+    for(j = 0; j < value_count && !bad; j++){
+        if(t->block_ids[j] >= t->node_count) bad = 1;
+    }
+
+    free(has_parent);
+    if(bad){
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+//Map the image file fname as t, which must be unused. The header and
+//section sizes are always checked. If check is set, so are the links, in
+//one pass over the image; else the file is only mapped, not read, so this
+//takes the same time for any size of tree, with pages coming in as the
+//search touches them, and only images ctree_save wrote should be mapped.
+//Returns 0 on success, else -1 with errno set (EINVAL for a bad image).
+int ctree_map(ctree *t, const char *fname, int check)
+{
+    ctree_image_header h;
+    struct stat st;
+    char *map;
+    uint64_t off, nodes_off, blocks_off, values_off, ids_off;
+    int fd, err;
+
+    ctree_init(t);
+    if((fd = open(fname, O_RDONLY)) < 0) return -1;
+    if(fstat(fd, &st) < 0){
+        err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    if((size_t)st.st_size < sizeof(h) || read(fd, &h, sizeof(h)) != sizeof(h)){
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+
+    //Sections are laid out as ctree_save wrote them; they must all fit.
+    nodes_off = image_align(sizeof(h));
+    blocks_off = nodes_off + image_align(sizeof(ctreenode) * h.node_count);
+    values_off = blocks_off + image_align(sizeof(ctreeblock) * h.block_count);
+    ids_off = values_off + image_align(sizeof(int) * h.block_value_count);
+    off = ids_off + sizeof(uint32_t) * h.block_value_count;
+    if(memcmp(h.magic, CTREE_IMAGE_MAGIC, CTREE_IMAGE_MAGIC_LEN) != 0 ||
+       h.byte_order != CTREE_IMAGE_BYTE_ORDER ||
+       h.node_count > CTREE_MAX_NODES || h.block_count > h.node_count ||
+       h.block_value_count > h.node_count ||
+       (h.node_count > 0 && h.head >= h.node_count) ||
+       off > (uint64_t)st.st_size){
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+
+    map = (char *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    err = errno;
+    close(fd);
+    if(map == MAP_FAILED){
+        errno = err;
+        return -1;
+    }
+
+    t->map = map;
+    t->map_len = st.st_size;
+    t->head = (h.node_count > 0) ? h.head : CTREE_NIL;
+    t->node_count = h.node_count;
+    t->nodes = (ctreenode *)(map + nodes_off);
+    t->block_count = h.block_count;
+    if(h.block_count > 0){
+        t->blocks = (ctreeblock *)(map + blocks_off);
+        t->block_values = (int *)(map + values_off);
+        t->block_ids = (uint32_t *)(map + ids_off);
+    }
+    if(check && image_check(t, h.block_value_count) != 0){
+        err = errno;
+        ctree_free(t);
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+//Children of node i, looking through leaf block markers.
+uint32_t ctree_left(ctree *t, uint32_t i)
+{
+    ctreenode *n = &t->nodes[i];
+    return ctreenode_isblock(n) ? t->blocks[n->right].left : n->left;
+}
+
+uint32_t ctree_right(ctree *t, uint32_t i)
+{
+    ctreenode *n = &t->nodes[i];
+    return ctreenode_isblock(n) ? t->blocks[n->right].right : n->right;
+}
+
+//Flatten every largest subtree of at most max_size nodes (and at least two)
+//into a leaf block. The nodes inside a block stay in the arena untouched,
+//only the block's root is relinked. Call at most once per tree. Returns 1
+//on success, 0 if memory ran out, leaving the tree as it was.
+int ctree_make_blocks(ctree *t, unsigned long max_size)
+{
+    uint32_t *pre, *size, *stack;
+    uint32_t i, left, right;
+    unsigned long n = t->node_count;
+    unsigned long np = 0, sp = 0, p, k, b, offset;
+    unsigned long num_blocks = 0, num_values = 0;
+
+    if(t->head == CTREE_NIL || max_size < 2) return 1;
+
+    pre = (uint32_t *)malloc(sizeof(uint32_t) * n);
+    size = (uint32_t *)malloc(sizeof(uint32_t) * n);
+    stack = (uint32_t *)malloc(sizeof(uint32_t) * n);
+    if(pre == NULL || size == NULL || stack == NULL){
+        free(pre);
+        free(size);
+        free(stack);
+        return 0;
+    }
+
+    //Preorder, left subtree first, without recursing: random trees can be
+    //far too deep for the C stack.
+    stack[sp++] = t->head;
+    while(sp > 0){
+        i = stack[--sp];
+        pre[np++] = i;
+        if(t->nodes[i].right != CTREE_NIL) stack[sp++] = t->nodes[i].right;
+        if(t->nodes[i].left != CTREE_NIL) stack[sp++] = t->nodes[i].left;
+    }
+    free(stack);
+
+    //Reverse preorder reaches every node after all of its descendants.
+    for(p = np; p-- > 0; ){
+        i = pre[p];
+        left = t->nodes[i].left;
+        right = t->nodes[i].right;
+        size[i] = 1 + ((left != CTREE_NIL) ? size[left] : 0) +
+                      ((right != CTREE_NIL) ? size[right] : 0);
+    }
+
+    //A subtree is contiguous in preorder, so blocks can be found (and
+    //skipped over) in one pass. First count them.
+    for(p = 0; p < np; ){
+        i = pre[p];
+        if(size[i] >= 2 && size[i] <= max_size){
+            num_blocks++;
+            num_values += size[i];
+            p += size[i];
+        } else {
+            p++;
+        }
+    }
+
+    t->blocks = (ctreeblock *)malloc(sizeof(ctreeblock) * (num_blocks + 1));
+    t->block_values = (int *)malloc(sizeof(int) * (num_values + 1));
+    t->block_ids = (uint32_t *)malloc(sizeof(uint32_t) * (num_values + 1));
+    if(t->blocks == NULL || t->block_values == NULL || t->block_ids == NULL){
+        free(t->blocks);
+        free(t->block_values);
+        free(t->block_ids);
+        t->blocks = NULL;
+        t->block_values = NULL;
+        t->block_ids = NULL;
+        free(pre);
+        free(size);
+        return 0;
+    }
+
+    //Then fill them in.
+    b = 0;
+    offset = 0;
+    for(p = 0; p < np; ){
+        i = pre[p];
+        if(size[i] < 2 || size[i] > max_size){
+            p++;
+            continue;
+        }
+        t->blocks[b].offset = offset;
+        t->blocks[b].length = size[i];
+        t->blocks[b].left = t->nodes[i].left;
+        t->blocks[b].right = t->nodes[i].right;
+        for(k = 0; k < size[i]; k++){
+            t->block_values[offset + k] = t->nodes[pre[p + k]].value;
+            t->block_ids[offset + k] = pre[p + k];
+        }
+        t->nodes[i].left = CTREE_BLOCK;
+        t->nodes[i].right = b;
+        offset += size[i];
+        p += size[i];
+        b++;
+    }
+    t->block_count = num_blocks;
+
+    free(pre);
+    free(size);
+    return 1;
+}
+
+void ctree_print_r(ctree *t, uint32_t i, FILE *f)
+{
+    if(i == CTREE_NIL) return;
+    ctreenode_print(t, i, f);
+    ctree_print_r(t, ctree_left(t, i), f);
+    ctree_print_r(t, ctree_right(t, i), f);
+}
+
+void ctree_print(ctree *t, FILE *f)
+{
+    ctree_print_r(t, t->head, f);
+}
+
+void ctree_visit_r(ctree *t, uint32_t i, ctreenode_func func, void *arg)
+{
+    if(i == CTREE_NIL) return;
+    (*func)(t, i, arg);
+    ctree_visit_r(t, ctree_left(t, i), func, arg);
+    ctree_visit_r(t, ctree_right(t, i), func, arg);
+}
+
+void ctree_visit(ctree *t, ctreenode_func func, void *arg)
+{
+    ctree_visit_r(t, t->head, func, arg);
+}
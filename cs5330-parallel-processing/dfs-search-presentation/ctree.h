@@ -0,0 +1,86 @@
+//Written by David Ells
+//
+//A compact binary tree ADT. All nodes live in one contiguous array (the
+//arena), children are 32 bit indices into that array, and the value is
+//stored inline in the node. A node's id is its index in the arena.
+//
+//Optionally, small subtrees can be flattened into leaf blocks: the values
+//of the subtree, in preorder, stored together in block_values so they can
+//be scanned as an array. The root of such a subtree is marked by a left
+//link of CTREE_BLOCK and a right link holding its index in blocks.
+//
+//Since links are indices, a tree can be saved as an image file and mapped
+//back as is, with no parsing or rebuilding.
+
+#ifndef CTREE_H
+#define CTREE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define CTREE_NIL UINT32_MAX
+#define CTREE_BLOCK (UINT32_MAX - 1)
+#define CTREE_MAX_NODES (CTREE_NIL - 2)
+
+#define CTREE_IMAGE_MAGIC "DSPCTRv1"
+#define CTREE_IMAGE_MAGIC_LEN 8
+#define CTREE_IMAGE_BYTE_ORDER 0x01020304u
+#define CTREE_IMAGE_ALIGN 64
+
+typedef struct {
+    int value;
+    uint32_t left;
+    uint32_t right;
+} ctreenode;
+
+typedef struct {
+    uint32_t offset;        //first value in block_values
+    uint32_t length;        //subtree size, including the root
+    uint32_t left;          //root's original links
+    uint32_t right;
+} ctreeblock;
+
+typedef struct {
+    ctreenode *nodes;
+    uint32_t head;
+    unsigned long node_count;
+    ctreeblock *blocks;
+    unsigned long block_count;
+    int *block_values;
+    uint32_t *block_ids;    //node id of each value in block_values
+    void *map;              //image the arrays point into, or NULL if malloc'd
+    size_t map_len;
+} ctree;
+
+//Header of a tree image. The nodes, blocks, block values and block ids
+//follow, each starting on a CTREE_IMAGE_ALIGN boundary. Images are in the
+//byte order of the machine that wrote them, which byte_order tells.
+typedef struct {
+    char magic[CTREE_IMAGE_MAGIC_LEN];
+    uint32_t byte_order;
+    uint32_t head;
+    uint64_t node_count;
+    uint64_t block_count;
+    uint64_t block_value_count;
+} ctree_image_header;
+
+typedef void (*ctreenode_func)(ctree *, uint32_t, void *);
+
+void ctreenode_init(ctreenode *, int);
+int ctreenode_isleaf(ctreenode *);
+int ctreenode_isblock(ctreenode *);
+void ctreenode_print(ctree *, uint32_t, FILE *);
+void ctree_init(ctree *);
+int ctree_alloc(ctree *, unsigned long);
+void ctree_free(ctree *);
+int ctree_make_blocks(ctree *, unsigned long);
+int ctree_save(ctree *, const char *);
+int ctree_map(ctree *, const char *, int);
+uint32_t ctree_left(ctree *, uint32_t);
+uint32_t ctree_right(ctree *, uint32_t);
+void ctree_print_r(ctree *, uint32_t, FILE *);
+void ctree_print(ctree *, FILE *);
+void ctree_visit_r(ctree *, uint32_t, ctreenode_func, void *);
+void ctree_visit(ctree *, ctreenode_func, void *);
+
+#endif
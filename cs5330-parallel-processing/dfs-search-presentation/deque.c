@@ -0,0 +1,199 @@
+//Written by David Ells
+//
+//Lock-free work stealing deque (Chase & Lev). See deque.h.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "deque.h"
+
+#define DSP_DEQUE_MIN_SIZE 64
+
+static dsp_deque_array_t *deque_array_create(long size)
+{
+    dsp_deque_array_t *a;
+
+    a = (dsp_deque_array_t *)malloc(sizeof(dsp_deque_array_t) +
+                                    sizeof(_Atomic(void *)) * size);
+    if(a == NULL){
+        perror("dsp_deque: error allocating deque array");
+        exit(1);
+    }
+    a->size = size;
+    a->next_retired = NULL;
+    return a;
+}
+
+//Called by the owner when the array is full. The old array is not freed,
+//since a thief may still be reading from it; it is kept on the retired list
+//until the deque is destroyed.
+static dsp_deque_array_t *deque_grow(dsp_deque_t *q, dsp_deque_array_t *a,
+                                     long top, long bottom)
+{
+    dsp_deque_array_t *na;
+    long i;
+
+    na = deque_array_create(a->size * 2);
+    for(i = top; i < bottom; i++){
+        atomic_store_explicit(&na->buf[i & (na->size - 1)],
+            atomic_load_explicit(&a->buf[i & (a->size - 1)], memory_order_relaxed),
+            memory_order_relaxed);
+    }
+    a->next_retired = q->retired;
+    q->retired = a;
+    atomic_store_explicit(&q->array, na, memory_order_release);
+    return na;
+}
+
+void dsp_deque_init(dsp_deque_t *q, long size)
+{
+    long n = DSP_DEQUE_MIN_SIZE;
+
+    //Array sizes are kept at powers of two so indexing is a mask.
+    while(n < size) n *= 2;
+
+    atomic_init(&q->top, 0);
+    atomic_init(&q->bottom, 0);
+    atomic_init(&q->array, deque_array_create(n));
+    q->retired = NULL;
+}
+
+dsp_deque_t *dsp_deque_create(long size)
+{
+    dsp_deque_t *q;
+
+    if(posix_memalign((void **)&q, DSP_CACHELINE, sizeof(dsp_deque_t)) != 0)
+        return NULL;
+    dsp_deque_init(q, size);
+    return q;
+}
+
+//Empty the deque for reuse. Must not race with any other operation.
+void dsp_deque_reset(dsp_deque_t *q)
+{
+    atomic_store(&q->top, 0);
+    atomic_store(&q->bottom, 0);
+}
+
+void dsp_deque_destroy(dsp_deque_t *q)
+{
+    dsp_deque_array_t *a, *next;
+
+    free(atomic_load(&q->array));
+    for(a = q->retired; a != NULL; a = next){
+        next = a->next_retired;
+        free(a);
+    }
+    free(q);
+}
+
+
+void dsp_deque_push(dsp_deque_t *q, void *data)
+{
+    long b, t;
+    dsp_deque_array_t *a;
+
+    b = atomic_load_explicit(&q->bottom, memory_order_relaxed);
+    t = atomic_load_explicit(&q->top, memory_order_acquire);
+    a = atomic_load_explicit(&q->array, memory_order_relaxed);
+    if(b - t > a->size - 1){
+        a = deque_grow(q, a, t, b);
+    }
+    atomic_store_explicit(&a->buf[b & (a->size - 1)], data, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&q->bottom, b + 1, memory_order_relaxed);
+}
+
+void *dsp_deque_pop(dsp_deque_t *q)
+{
+    long b, t;
+    dsp_deque_array_t *a;
+    void *data;
+
+    b = atomic_load_explicit(&q->bottom, memory_order_relaxed) - 1;
+    a = atomic_load_explicit(&q->array, memory_order_relaxed);
+    atomic_store_explicit(&q->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    t = atomic_load_explicit(&q->top, memory_order_relaxed);
+
+    if(t > b){
+        //Empty, put bottom back.
+        atomic_store_explicit(&q->bottom, b + 1, memory_order_relaxed);
+        return NULL;
+    }
+
+    data = atomic_load_explicit(&a->buf[b & (a->size - 1)], memory_order_relaxed);
+    if(t == b){
+        //Last element, race any thieves for it.
+        if(!atomic_compare_exchange_strong_explicit(&q->top, &t, t + 1,
+                memory_order_seq_cst, memory_order_relaxed)){
+            data = NULL;
+        }
+        atomic_store_explicit(&q->bottom, b + 1, memory_order_relaxed);
+    }
+    return data;
+}
+
+void *dsp_deque_steal(dsp_deque_t *q)
+{
+    long b, t;
+    dsp_deque_array_t *a;
+    void *data;
+
+    t = atomic_load_explicit(&q->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    b = atomic_load_explicit(&q->bottom, memory_order_acquire);
+    if(t >= b) return NULL;
+
+    a = atomic_load_explicit(&q->array, memory_order_acquire);
+    data = atomic_load_explicit(&a->buf[t & (a->size - 1)], memory_order_relaxed);
+    if(!atomic_compare_exchange_strong_explicit(&q->top, &t, t + 1,
+            memory_order_seq_cst, memory_order_relaxed)){
+        return DSP_DEQUE_ABORT;
+    }
+    return data;
+}
+
+//Steal up to max of the oldest entries of q and push them onto dest, which
+//must be owned by the calling thread. If max is 0, half of q is taken (at
+//least one entry). Each entry is claimed with its own CAS: claiming several
+//with one CAS on top is not safe, since the owner pops without a CAS while
+//it sees more than one entry left. Returns the number of entries moved.
+long dsp_deque_steal_batch(dsp_deque_t *q, dsp_deque_t *dest, long max)
+{
+    long n = 0;
+    void *data;
+
+    if(max <= 0){
+        max = dsp_deque_size(q) / 2;
+        if(max < 1) max = 1;
+    }
+
+    while(n < max){
+        data = dsp_deque_steal(q);
+        if(data == DSP_DEQUE_ABORT){
+            //Keep trying for the first entry, but once we have some work
+            //a lost race is a good sign to leave the rest to the owner.
+            if(n == 0) continue;
+            break;
+        }
+        if(data == NULL) break;
+        dsp_deque_push(dest, data);
+        n++;
+    }
+    return n;
+}
+
+//Only a snapshot when other threads are active.
+long dsp_deque_size(dsp_deque_t *q)
+{
+    long b, t;
+
+    b = atomic_load_explicit(&q->bottom, memory_order_relaxed);
+    t = atomic_load_explicit(&q->top, memory_order_relaxed);
+    return (b > t) ? b - t : 0;
+}
+
+int dsp_deque_isempty(dsp_deque_t *q)
+{
+    return (dsp_deque_size(q) == 0);
+}
@@ -0,0 +1,46 @@
+//Written by David Ells
+//
+//Lock-free work stealing deque (Chase & Lev, "Dynamic Circular Work-Stealing
+//Deque", SPAA 2005, using the C11 orderings from Le et al., PPoPP 2013).
+//
+//Only the owning thread may call dsp_deque_push and dsp_deque_pop, which work
+//on the bottom (newest) end. Any other thread may call dsp_deque_steal, which
+//takes from the top (oldest) end using a single CAS.
+
+#ifndef DEQUE_H
+#define DEQUE_H
+
+#include <stdatomic.h>
+
+#define DSP_CACHELINE 64
+
+//Returned by dsp_deque_steal when it lost a race with another thread.
+//The deque may still hold work, so the caller is free to retry.
+#define DSP_DEQUE_ABORT ((void *)-1)
+
+typedef struct dsp_deque_array {
+    long size;
+    struct dsp_deque_array *next_retired;
+    _Atomic(void *) buf[];
+} dsp_deque_array_t;
+
+typedef struct {
+    _Alignas(DSP_CACHELINE) atomic_long top;
+    _Alignas(DSP_CACHELINE) atomic_long bottom;
+    _Atomic(dsp_deque_array_t *) array;
+    dsp_deque_array_t *retired;
+} dsp_deque_t;
+
+dsp_deque_t *dsp_deque_create(long);
+void dsp_deque_init(dsp_deque_t *, long);
+void dsp_deque_reset(dsp_deque_t *);
+void dsp_deque_destroy(dsp_deque_t *);
+
+void dsp_deque_push(dsp_deque_t *, void *);
+void *dsp_deque_pop(dsp_deque_t *);
+void *dsp_deque_steal(dsp_deque_t *);
+long dsp_deque_steal_batch(dsp_deque_t *, dsp_deque_t *, long);
+long dsp_deque_size(dsp_deque_t *);
+int dsp_deque_isempty(dsp_deque_t *);
+
+#endif
@@ -0,0 +1,271 @@
+/* Written by David Ells
+ *
+ * Benchmark driver for dfs-search and index-search. Each configuration
+ * (random tree, balanced tree, linear index search) is run once per thread
+ * count with -r, so the tree is built once and searched over and over. The
+ * first few searches are thrown away as warmups, and the rest summarized
+ * by median, 95th percentile, mean and standard deviation, with speedup
+ * and parallel efficiency of the medians against one thread.
+ * Replaces runtests.py. */
+
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PROGNAME "dfsbench"
+#define DFSBENCH_THREAD_MAX 128
+#define DFSBENCH_COUNTS_MAX 32
+#define DFSBENCH_CMD_MAX 4096
+#define DFSBENCH_LINE_MAX 1024
+
+typedef struct {
+    const char *name;
+    char command[DFSBENCH_CMD_MAX];     //program and flags
+} bench_config;
+
+typedef struct {
+    double median;
+    double p95;
+    double mean;
+    double stddev;
+} bench_summary;
+
+int run_config(bench_config *c, const char *fname, const char *val, int num_threads,
+               int warmups, int reps, double *times);
+void summarize(double *times, int n, bench_summary *s);
+int compare_double(const void *a, const void *b);
+int parse_thread_counts(const char *list, int *counts);
+int config_listed(const char *list, const char *name);
+
+void printUsage()
+{
+    printf("\t" PROGNAME " [-h | -w warmups | -n repeats | -t threads,... |\n"
+           "\t\t-e flags | -c configs | -d dir] [filename] [searchvalue]\n");
+}
+
+void printHelp()
+{
+    printUsage();
+    printf("\n\t" PROGNAME " times dfs-search on a random and a balanced tree,\n"
+           "\tand index-search, over the file named, for each thread count.\n"
+           "\tPrints median, 95th percentile, mean and standard deviation of\n"
+           "\tthe search time in seconds, and the speedup and efficiency of\n"
+           "\tthe median against one thread, which is run first even if\n"
+           "\tnot listed (n/a if it fails). A search value that is not in\n"
+           "\tthe file times full traversals.\n");
+    printf("\tOptions:\n"
+           "\t\t-h : show this help\n"
+           "\t\t-w : searches thrown away before timing (default 2)\n"
+           "\t\t-n : searches timed per thread count (default 10)\n"
+           "\t\t-t : comma separated thread counts (default 1,2,4,8)\n"
+           "\t\t-e : extra flags for dfs-search, such as \"-c -B 64\"\n"
+           "\t\t-c : comma separated configurations to run, of random,\n"
+           "\t\t     balanced and index (default all three)\n"
+           "\t\t-d : directory holding the programs (default .)\n\n");
+}
+
+int main(int argc, char **argv)
+{
+    int c, i, j, n;
+    int warmups = 2, reps = 10;
+    int counts[DFSBENCH_COUNTS_MAX + 1];    //room to put 1 in front
+    int num_counts;
+    const char *extra = "";
+    const char *dir = ".";
+    const char *list = "random,balanced,index";
+    bench_config configs[3];
+    bench_summary s;
+    double *times;
+    double base;
+
+    num_counts = parse_thread_counts("1,2,4,8", counts);
+    while((c = getopt(argc, argv, "+hw:n:t:e:c:d:")) != -1){
+        switch(c){
+        case 'h':
+            printf("\n");
+            printHelp();
+            exit(0);
+        case 'w':
+            warmups = atoi(optarg);
+            break;
+        case 'n':
+            reps = atoi(optarg);
+            break;
+        case 't':
+            num_counts = parse_thread_counts(optarg, counts);
+            if(num_counts == 0){
+                printf(PROGNAME ": error: thread counts must be 1 to %d, at most %d of them\n",
+                       DFSBENCH_THREAD_MAX, DFSBENCH_COUNTS_MAX);
+                printUsage();
+                exit(1);
+            }
+            break;
+        case 'e':
+            extra = optarg;
+            break;
+        case 'c':
+            list = optarg;
+            break;
+        case 'd':
+            dir = optarg;
+            break;
+        default:
+            printUsage();
+            exit(1);
+        }
+    }
+    //Speedup and efficiency are against one thread.
+    if(counts[0] != 1){
+        memmove(&counts[1], &counts[0], sizeof(int) * num_counts);
+        counts[0] = 1;
+        num_counts++;
+    }
+
+    if(argc - optind != 2){
+        printf(PROGNAME ": error: wrong number of arguments\n");
+        printUsage();
+        exit(1);
+    }
+    if(warmups < 0 || reps < 1){
+        printf(PROGNAME ": error: warmups must be nonnegative and repeats positive\n");
+        printUsage();
+        exit(1);
+    }
+
+    configs[0].name = "random";
+    snprintf(configs[0].command, DFSBENCH_CMD_MAX, "%s/dfs-search %s", dir, extra);
+    configs[1].name = "balanced";
+    snprintf(configs[1].command, DFSBENCH_CMD_MAX, "%s/dfs-search -b %s", dir, extra);
+    configs[2].name = "index";
+    snprintf(configs[2].command, DFSBENCH_CMD_MAX, "%s/index-search", dir);
+
+    times = (double *)malloc(sizeof(double) * (warmups + reps));
+    if(times == NULL){
+        perror(PROGNAME ": error: error allocating memory");
+        exit(1);
+    }
+
+    printf("config\t\tthreads\t\tmedian\t\tp95\t\tmean\t\tstddev\t\tspeedup\t\tefficiency\n");
+    for(i = 0; i < 3; i++){
+        if(!config_listed(list, configs[i].name)) continue;
+        base = 0.0;         //1 thread median, 0 if that run failed
+        for(j = 0; j < num_counts; j++){
+            n = run_config(&configs[i], argv[optind], argv[optind+1], counts[j],
+                           warmups, reps, times);
+            if(n < reps){
+                fprintf(stderr, PROGNAME ": error: %s gave %d of %d timings with %d threads\n",
+                        configs[i].command, n, reps, counts[j]);
+                continue;
+            }
+            summarize(times, reps, &s);
+            if(j == 0) base = s.median;
+            printf("%s\t\t%d\t\t%.9f\t%.9f\t%.9f\t%.9f", configs[i].name, counts[j],
+                   s.median, s.p95, s.mean, s.stddev);
+            if(base > 0.0 && s.median > 0.0)
+                printf("\t%.2f\t\t%.2f\n", base / s.median, base / s.median / counts[j]);
+            else
+                printf("\tn/a\t\tn/a\n");
+            fflush(stdout);
+        }
+    }
+
+    free(times);
+    return 0;
+}
+
+//Run one configuration with num_threads threads, warmups + reps searches
+//in one process, and put the times of the last reps in times. Result lines
+//are the ones starting with the size and the thread count; the time is the
+//third column. Returns the number of times kept.
+int run_config(bench_config *c, const char *fname, const char *val, int num_threads,
+               int warmups, int reps, double *times)
+{
+    char cmd[DFSBENCH_CMD_MAX + 256];
+    char line[DFSBENCH_LINE_MAX];
+    FILE *out;
+    long size;
+    int threads, n = 0;
+    double t;
+
+    snprintf(cmd, sizeof(cmd), "%s -r %d '%s' %s %d 2>/dev/null", c->command,
+             warmups + reps, fname, val, num_threads);
+    out = popen(cmd, "r");
+    if(out == NULL){
+        perror(PROGNAME ": error: problem running search");
+        exit(1);
+    }
+    while(fgets(line, sizeof(line), out) != NULL){
+        if(sscanf(line, "%ld %d %lf", &size, &threads, &t) != 3 || threads != num_threads)
+            continue;
+        if(n++ >= warmups) times[n - warmups - 1] = t;
+        if(n == warmups + reps) break;
+    }
+    while(fgets(line, sizeof(line), out) != NULL);
+    pclose(out);
+    return (n > warmups) ? n - warmups : 0;
+}
+
+void summarize(double *times, int n, bench_summary *s)
+{
+    double sum = 0.0, sq = 0.0;
+    int i;
+
+    qsort(times, n, sizeof(double), compare_double);
+    s->median = (n % 2) ? times[n/2] : (times[n/2 - 1] + times[n/2]) / 2.0;
+    //Nearest rank.
+    s->p95 = times[(int)ceil(0.95 * n) - 1];
+    for(i = 0; i < n; i++){
+        sum += times[i];
+    }
+    s->mean = sum / n;
+    for(i = 0; i < n; i++){
+        sq += (times[i] - s->mean) * (times[i] - s->mean);
+    }
+    s->stddev = (n > 1) ? sqrt(sq / (n - 1)) : 0.0;
+}
+
+int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+//Parse a list like "1,2,4,8" into counts. Returns how many there were, or
+//0 if the list is bad.
+int parse_thread_counts(const char *list, int *counts)
+{
+    const char *p = list;
+    char *end;
+    long v;
+    int n = 0;
+
+    while(*p != '\0'){
+        v = strtol(p, &end, 10);
+        if(end == p || v < 1 || v > DFSBENCH_THREAD_MAX || n == DFSBENCH_COUNTS_MAX)
+            return 0;
+        counts[n++] = (int)v;
+        p = end;
+        if(*p == ',') p++;
+        else if(*p != '\0') return 0;
+    }
+    return n;
+}
+
+//Returns 1 if name is one of the comma separated names in list.
+int config_listed(const char *list, const char *name)
+{
+    size_t len = strlen(name);
+    const char *p = list;
+
+    while(p != NULL){
+        if(strncmp(p, name, len) == 0 && (p[len] == ',' || p[len] == '\0'))
+            return 1;
+        p = strchr(p, ',');
+        if(p != NULL) p++;
+    }
+    return 0;
+}
@@ -4,17 +4,42 @@
  * Run with -h flag to see usage and help. */
 
 #include <errno.h>
+#include <getopt.h>
+#include <limits.h>
 #include <pthread.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/time.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef DFS_MPI
+#include <mpi.h>
+#endif
 
 #include "tree.h"
+#include "ctree.h"
+#include "itree.h"
+#include "etree.h"
+#include "deque.h"
 #include "stack.h"
-
+#include "intfile.h"
+#include "valset.h"
+#include "pool.h"
+#include "simd.h"
+#include "treebuild.h"
+#include "stats.h"
+#include "numa.h"
+#include "pqueue.h"
+#include "reduce.h"
+#include "rng.h"
+
+#ifdef DFS_MPI
+#define PROGNAME "dfs-search-mpi"
+#else
 #define PROGNAME "dfs-search"
+#endif
 
 //Global constants
 const int DFS_THREAD_MAX = 128;
@@ -22,24 +47,324 @@ const int DFS_DEBUG_THREADS = 0;
 const int DFS_DEBUG_TREE = 0;
 const int DFS_DEBUG_PROGRESS = 0;
 
+//Steal half of the victim's deque when DFS_STEAL_CHUNK is 0.
+const int DFS_STEAL_HALF = 0;
+
+//Nodes (or, for the implicit layout, values) a thread takes at a time from
+//a BFS level.
+const long DFS_BFS_CHUNK = 1024;
+
+//Heaps per thread in the best-first priority queue.
+const int DFS_BEST_QUEUES_PER_THREAD = 2;
+
+//Idle threads back off between looks for work: a few yields first, then
+//sleeps that double from DFS_IDLE_SLEEP_MIN_NS up to DFS_IDLE_SLEEP_MAX_NS.
+const int DFS_IDLE_YIELDS = 16;
+const long DFS_IDLE_SLEEP_MIN_NS = 1000;
+const long DFS_IDLE_SLEEP_MAX_NS = 256000;
+
+#ifdef DFS_MPI
+//Subtrees dealt to each rank at the start of an MPI search, unless -u says
+//otherwise. More give idle ranks more to steal, fewer cost fewer messages.
+const int DFS_MPI_UNITS_PER_RANK = 16;
+
+//How long the MPI thread of a rank sleeps when it has nothing to do.
+const long DFS_MPI_POLL_NS = 20000;
+#endif
+
+//Tree layouts the search can run over.
+typedef enum {
+    DFS_LAYOUT_POINTER,     //one malloc'd treenode per value
+    DFS_LAYOUT_COMPACT,     //ctree arena, 32 bit child indices
+    DFS_LAYOUT_IMPLICIT,    //itree, values in BFS order, no child links
+    DFS_LAYOUT_SORTED       //etree, sorted index for -m bst
+} dfs_layout;
+
+//The tree being searched, in whichever layout was built. Work items on the
+//deques are treenode pointers, ctreenode pointers or pointers into the
+//itree's values accordingly. The sorted index is not traversed, only
+//looked up in.
+typedef struct {
+    dfs_layout layout;
+    tree *ptree;
+    ctree *ctree;
+    itree *itree;
+    etree *etree;
+    unsigned long root;     //implicit layout: node depth first searches start
+                            //from, 0 but for the subtrees of an MPI search
+} dfs_tree;
+
+//How per thread counters are reported after each search.
+typedef enum {
+    DFS_STATS_NONE,
+    DFS_STATS_TEXT,         //table on stderr
+    DFS_STATS_JSON          //one JSON object per line on stdout
+} dfs_stats_format;
+
+//Order the tree is searched in.
+typedef enum {
+    DFS_MODE_DFS,           //depth first, left descend and right push
+    DFS_MODE_BFS,           //level synchronous breadth first
+    DFS_MODE_BEST,          //best first, closest value to the search value
+    DFS_MODE_BST            //binary search of a sorted index, no tree
+} dfs_search_mode;
+
+//One thread's part of a BFS level.
+typedef struct {
+    _Alignas(DSP_CACHELINE) void **nodes;
+    long count;
+    long size;
+} dfs_frontier;
+
+//Which other threads a thief tries, by NUMA node.
+typedef enum {
+    DFS_VICTIMS_ALL,
+    DFS_VICTIMS_LOCAL,      //same node as the thief
+    DFS_VICTIMS_REMOTE      //other nodes
+} dfs_victims;
+
+//How a depth first worker's right children become stealable.
+typedef enum {
+    DFS_PUBLISH_LAZY,       //kept on a private stack, moved to the deque when
+                            //a thief asks for work
+    DFS_PUBLISH_EAGER       //pushed straight onto the deque
+} dfs_publish_mode;
+
+//A worker's private work. Only the owner touches the stack; thieves only
+//set hungry, which has a cache line of its own.
+typedef struct {
+    _Alignas(DSP_CACHELINE) atomic_int hungry;
+    _Alignas(DSP_CACHELINE) dsp_stack_t stack;
+} dfs_private_work;
+
+//Which victim a thief tries first. Whoever it starts with, it goes on
+//through all the others in order until one has work.
+typedef enum {
+    DFS_STEAL_RANDOM,       //a random one, from the thief's own generator
+    DFS_STEAL_ROUND_ROBIN,  //the one after the last first choice
+    DFS_STEAL_LAST,         //the last one stolen from, else a random one
+    DFS_STEAL_HIER          //random, but every thread on the thief's NUMA
+                            //node before any on another
+} dfs_steal_policy;
+
+//A thief's own victim selection state.
+typedef struct {
+    _Alignas(DSP_CACHELINE) dsp_rng_t rng;
+    int next;               //round robin first choice
+    int last_victim;        //-1 until a steal succeeds
+} dfs_thief;
+
+#ifdef DFS_MPI
+//Messages of an MPI search, by tag. Every message carries longs.
+typedef enum {
+    DFS_MPI_STEAL = 1,      //thief to victim, empty: send me some subtrees
+    DFS_MPI_WORK,           //victim to thief: subtree roots, maybe none
+    DFS_MPI_DONE,           //to rank 0: number of subtrees searched
+    DFS_MPI_FOUND,          //to rank 0: node id of a hit
+    DFS_MPI_STOP            //from rank 0: node id of the hit, or -1
+} dfs_mpi_tag;
+
+//A send still in flight and the buffer it sends from.
+typedef struct {
+    MPI_Request req;
+    long *buf;
+} dfs_mpi_send;
+
+//One rank's part of an MPI search. The main thread does all the MPI
+//calls; a runner thread takes subtree roots off units and searches them
+//with the pool. Fields from units to stop are shared between the two
+//under lock.
+typedef struct {
+    int rank;
+    int num_ranks;
+    int num_threads;
+    dfs_tree *tree;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;            //runner waits here for units or stop
+    long *units;                    //roots waiting in units[first..last)
+    long first;
+    long last;
+    long size;
+    int busy;                       //runner is searching a subtree
+    long finished;                  //subtrees searched, not yet reported
+    long hit;                       //hit not yet reported, or -1
+    int found;                      //runner had a hit, so stops looking
+    int stop;
+    dfs_mpi_send *sends;
+    int num_sends;
+    int max_sends;
+    long searched;                  //subtrees this rank searched
+    long stolen;                    //subtrees it got by stealing
+    long requests;                  //steal requests it sent
+} dfs_mpi_rank;
+#endif
+
+//Whether a search for one value stops at the first hit or finds them all.
+typedef enum {
+    DFS_HITS_FIRST,
+    DFS_HITS_ALL
+} dfs_hit_mode;
+
+//Node ids of the hits one thread found in all hits mode.
+typedef struct {
+    _Alignas(DSP_CACHELINE) long *ids;
+    long count;
+    long size;
+} dfs_hit_buffer;
+
+//Queries answered together by one traversal in batch mode (-q). Each
+//distinct value has a slot in set, indexing found and hit_time.
+typedef struct {
+    int *values;            //query values in file order
+    unsigned long count;
+    long *slot;             //slot of each query value
+    dsp_valset_t set;
+    unsigned long distinct;
+    atomic_int *found;
+    double *hit_time;       //seconds from search start to first hit
+    atomic_long found_count;
+} dfs_query_batch;
+
 //Global variables
 int DFS_NUM_THREADS, DFS_TREE_SIZE;
-int search_val, val_found;
-dsp_stack_t **thread_work_stack;
-
-pthread_t *threads;
-pthread_mutex_t *thread_work_stack_mutex;
-pthread_mutex_t val_found_mutex = PTHREAD_MUTEX_INITIALIZER;
+int DFS_STEAL_CHUNK = DFS_STEAL_HALF;
+dfs_stats_format DFS_STATS_FORMAT = DFS_STATS_NONE;
+int DFS_BLOCK_SIZE = 0;
+int DFS_REPEAT = 1;
+int DFS_REDUCE_BINS = -1;
+dfs_thread_stats *thread_stats;
+atomic_int idle_threads;
+dfs_hit_mode DFS_HIT_MODE = DFS_HITS_FIRST;
+dfs_search_mode DFS_SEARCH_MODE = DFS_MODE_DFS;
+int search_val;
+dfs_tree *search_tree;
+dfs_query_batch *query_batch;
+double search_start;
+dfs_search_phases search_phases;        //of the last search
+dsp_deque_t **thread_work_deque;
+dfs_private_work *thread_private_work;
+dfs_publish_mode DFS_PUBLISH_MODE = DFS_PUBLISH_LAZY;
+dfs_steal_policy DFS_STEAL_POLICY = DFS_STEAL_RANDOM;
+dfs_thief *thread_thieves;
+
+dsp_pool_t *search_pool;
+int search_max_threads;
+int search_setup_report = 1;        //print thread creation time on stderr
+
+//NUMA topology the workers are pinned to, or NULL, and how the node arena
+//is spread over its nodes by the first DFS_PLACE_THREADS workers.
+dsp_numa_t *search_numa;
+dsp_numa_placement DFS_PLACEMENT = DSP_NUMA_PLACE_NONE;
+int DFS_PLACE_THREADS;
+
+//Cancellation token, set once the search is over: on the first hit, or
+//when every query has been answered. Workers poll it with relaxed loads
+//(SEARCH_DONE), since they only need to see it eventually. cancel_start
+//is written before the token is set, for the time to cancel.
+atomic_int val_found;
+double cancel_start;
+atomic_long hit_node;       //node id of the first hit, or -1
+dfs_hit_buffer *thread_hits;
+
+#define SEARCH_DONE() atomic_load_explicit(&val_found, memory_order_relaxed)
+
+//Level synchronous BFS state. Each thread appends the children of the
+//nodes it visits to its own frontier of the next level; the current level
+//is all threads' frontiers of the other set, read through bfs_offsets as
+//though they were one array. For the implicit layout a level is just the
+//index range starting at bfs_level_start and no frontiers are kept.
+dfs_frontier *bfs_frontier[2];
+int bfs_next;                   //which set is being filled
+long *bfs_offsets;              //start of each thread's part of the level
+long bfs_total;                 //nodes in the current level
+unsigned long bfs_level_start;
+atomic_long bfs_cursor;         //next node of the level to hand out
+int bfs_done;
+pthread_barrier_t bfs_barrier;
+
+//Best first search state.
+dsp_multiqueue_t *best_queue;
 
 //Function prototypes
 tree *makeRandomTreeFromArray(int, int *, int);
 tree *makeBalancedTreeFromArray(int, int *, int);
-int search_tree_for_val(tree *t, int num_threads, int val);
-void *thread_traverse_tree(void *tid);
-treenode *get_next_available_treenode(int my_id);
+ctree *alloc_ctree_arena(int);
+ctree *makeRandomCTreeFromArray(int, int *, int);
+ctree *makeBalancedCTreeFromArray(int, int *, int);
+ctree *makeVebCTreeFromArray(int *, int);
+ctree *makeParallelCTreeFromArray(int, int, int *, int, int);
+tree *makeParallelTreeFromArray(int, int, int *, int, int);
+itree *makeBfsITreeFromArray(int *, int);
+etree *makeSortedETreeFromArray(int *, int, int);
+ctree *mapCTreeImage(const char *, int);
+void veb_assign(uint64_t root, int height, uint64_t n, uint32_t *pos, uint32_t *next);
+void *dfs_tree_head(dfs_tree *t);
+void *dfs_node_left(dfs_tree *t, void *n);
+void *dfs_node_right(dfs_tree *t, void *n);
+int dfs_node_value(dfs_tree *t, void *n, int *val);
+int dfs_node_isblock(dfs_tree *t, void *n);
+void search_setup(int max_threads);
+void search_teardown();
+void free_dfs_tree(dfs_tree *t);
+double run_parallel_search(dfs_tree *t, int num_threads);
+int search_tree_for_val(dfs_tree *t, int num_threads, int val);
+int search_tree_for_queries(dfs_tree *t, int num_threads, dfs_query_batch *b);
+void run_searches(dfs_tree *t, int num_threads, dfs_query_batch *b);
+void report_stats(dfs_tree *t, int num_threads, double search_time, long found, long queries);
+const char *dfs_layout_name(dfs_tree *t);
+const char *dfs_mode_name();
+dfs_query_batch *query_batch_create(int *vals, unsigned long count);
+void query_batch_destroy(dfs_query_batch *b);
+int check_query_value(int value);
+int check_value(int value, long node_id);
+void cancel_search();
+int report_hit(int id, long node_id);
+void hit_buffer_add(dfs_hit_buffer *h, long node_id);
+long *merge_hits(int num_threads, long *count);
+int compare_long(const void *a, const void *b);
+long dfs_node_id(dfs_tree *t, void *n);
+void thread_traverse_tree(int id, void *arg);
+int traverse_treenodes(int id, dsp_deque_t *q, treenode *n);
+int traverse_ctreenodes(int id, dsp_deque_t *q, ctree *t, ctreenode *n);
+int scan_ctreeblock(int id, ctree *t, ctreeblock *blk);
+int traverse_itreenodes(int id, dsp_deque_t *q, int *base, unsigned long count, int *n);
+int scan_values(int id, int *vals, long len, uint32_t *ids, long first_id);
+void thread_bfs(int id, void *arg);
+void bfs_next_level();
+void bfs_visit_level(int id);
+int bfs_visit_node(int id, dfs_frontier *next, void *n);
+void frontier_add(dfs_frontier *f, void *n);
+void thread_best_first(int id, void *arg);
+uint64_t best_priority(dfs_tree *t, void *n, uint64_t parent_key);
+void best_push(int id, dsp_rng_t *rng, uint64_t key, void *n);
+void thread_bst(int id, void *arg);
+void *best_wait_for_work(int my_id, dsp_rng_t *rng, uint64_t *key);
+void set_aside_node(int id, dsp_deque_t *q, void *n);
+void publish_private_work(int id, dsp_deque_t *q);
+void ask_for_work(int victim);
+void *get_next_available_treenode(int my_id);
+void *steal_from_victims(int my_id, dfs_victims which);
+int first_victim(int my_id);
+void *wait_for_work(int my_id);
+void idle_backoff(int *yields, struct timespec *sleep_time);
+void finish_thread_stats(dfs_thread_stats *st, double start);
+int work_available(int my_id);
+void run_reductions(dfs_tree *t, int num_threads);
+#ifdef DFS_MPI
+int mpi_main(int argc, char **argv);
+void *mpi_run_units(void *arg);
+long mpi_search(dfs_mpi_rank *mr, long total_units, long separator_hit);
+void mpi_add_units(dfs_mpi_rank *mr, long *roots, long count);
+void mpi_send(dfs_mpi_rank *mr, int dest, int tag, long *vals, int count);
+int mpi_test_sends(dfs_mpi_rank *mr);
+void mpi_stop_all(dfs_mpi_rank *mr, long node);
+void mpi_set_stop(dfs_mpi_rank *mr);
+#endif
 
 int randint(int);
 void printNode(treenode *, void *);
+void printCNode(ctree *, uint32_t, void *);
+void printINode(itree *, unsigned long, void *);
 void findVal(treenode *, void *);
 
 void tree_debug(int level, const char* message, ...);
@@ -54,7 +379,14 @@ void printArgError()
 
 void printUsage()
 {
-    printf("\t" PROGNAME " [-h | -b] [filename] [searchvalue] "
+    printf("\t" PROGNAME " [-h | -b | -c | -L layout | -B size | -j threads | -k chunk |\n"
+           "\t\t-m mode | -r repeats | -v |\n"
+           "\t\t--stats=text|json | --hits=first|all |\n"
+           "\t\t--topology=sys|file | --placement=first-touch|interleave |\n"
+           "\t\t--publish=lazy|eager | --steal=policy | --reduce=bins |\n"
+           "\t\t--save-tree=image | --load-tree[=trust]] [filename] "
+           "[searchvalue] [number of threads]\n"
+           "\t" PROGNAME " [options] -q [queryfile] [filename] "
            "[number of threads]\n");
 }
 
@@ -63,6 +395,8 @@ void printHelp()
     printUsage();
     printf("\n\t" PROGNAME " will process the file named, reading consecutive\n"
            "\tintegers the file and generating a binary tree from them.\n"
+           "\tThe file may be text, or a binary .i32 file as written by\n"
+           "\trandints --binary, which is mapped instead of parsed.\n"
            "\tIt will create the number of concurrent threads specified to\n"
            "\tperform the depth first search of the tree in parallel.\n"
            "\tNote that just one processor may also be specified.\n"
@@ -71,33 +405,306 @@ void printHelp()
            "\tstarting at 1 and doubling until reaching MAX_THREADS.\n");
     printf("\tOptions:\n"
            "\t\t-h : show this help\n"
-           "\t\t-b : build balanced (not random) tree\n\n");
+           "\t\t-b : build balanced (not random) tree\n"
+           "\t\t-c : build compact tree (one node array, 32 bit child\n"
+           "\t\t     indices, values stored inline)\n"
+           "\t\t-L : memory layout for the balanced tree (needs -b):\n"
+           "\t\t     bfs : implicit, values in breadth first order and\n"
+           "\t\t           children found by index arithmetic\n"
+           "\t\t     veb : compact tree in van Emde Boas order\n"
+           "\t\t-B : flatten subtrees of up to size nodes into leaf blocks\n"
+           "\t\t     of values, scanned with SIMD compares (implies -c;\n"
+           "\t\t     not with -L bfs)\n"
+           "\t\t-j : build the tree with this many threads. The tree\n"
+           "\t\t     depends on the input and the number of threads, and\n"
+           "\t\t     is not the one the serial build makes. -L layouts are\n"
+           "\t\t     always built serially\n"
+           "\t\t-k : nodes an idle thread steals from a victim at once,\n"
+           "\t\t     0 (the default) steals half of the victim's deque\n"
+           "\t\t-m : order to search the tree in:\n"
+           "\t\t     dfs  : depth first with work stealing (the default)\n"
+           "\t\t     bfs  : breadth first, one level at a time, each level\n"
+           "\t\t            shared out among the threads\n"
+           "\t\t     best : best first, nodes with values closest to the\n"
+           "\t\t            search value first, over a shared relaxed\n"
+           "\t\t            priority queue (shallowest first with -q)\n"
+           "\t\t     bst  : no tree; build a sorted index of the values\n"
+           "\t\t            (with -j threads, else all of them) and\n"
+           "\t\t            binary search it, splitting -q queries\n"
+           "\t\t            among the threads. Not with -b, -c, -L or -B\n"
+           "\t\t-r : run each search this many times, printing a result\n"
+           "\t\t     line each time, for benchmarks (see dfsbench)\n"
+           "\t\t-v : same as --stats=text\n"
+           "\t\t-q : answer every value in queryfile (text or .i32) with\n"
+           "\t\t     one traversal, in place of a single searchvalue. Prints\n"
+           "\t\t     value, found and latency per query, then a summary\n"
+           "\t\t     line of size, threads, time, distinct values found,\n"
+           "\t\t     distinct values and queries per second\n"
+           "\t\t--stats=text : after each search, print per thread counts\n"
+           "\t\t     of nodes visited, pushes, pops, steal attempts,\n"
+           "\t\t     steals, nodes stolen, and time spent stealing, idle\n"
+           "\t\t     and in total, as a table on stderr\n"
+           "\t\t--stats=json : the same as one JSON object per search on\n"
+           "\t\t     stdout, after the usual output\n"
+           "\t\t--hits=first : stop at the first node holding the search\n"
+           "\t\t     value (the default). The result line gets the node id\n"
+           "\t\t     of the hit as a fifth column, -1 if there was none\n"
+           "\t\t--hits=all : search the whole tree and print the id of\n"
+           "\t\t     every node holding the search value, one per line,\n"
+           "\t\t     before the result line, whose found column is then\n"
+           "\t\t     the number of hits and whose last column the lowest id.\n"
+           "\t\t     Node ids are input positions, except in the veb layout,\n"
+           "\t\t     where they are positions in the node array\n"
+           "\t\t--topology=sys : pin worker threads to CPUs, spread round\n"
+           "\t\t     robin over the NUMA nodes in /sys, and have idle\n"
+           "\t\t     threads steal from threads on their own node first\n"
+           "\t\t--topology=file : the same, with the topology read from\n"
+           "\t\t     file, one \"<node> <cpulist>\" line per node, to\n"
+           "\t\t     emulate a NUMA machine (see numa.h)\n"
+           "\t\t--placement=first-touch : spread the compact tree's node\n"
+           "\t\t     array over the nodes in one piece per build thread\n"
+           "\t\t     (-j, else per search thread), each placed on its\n"
+           "\t\t     thread's node. Needs --topology and a compact tree\n"
+           "\t\t     (-c, -B or -L veb): the pointer tree and -L bfs are\n"
+           "\t\t     not placed\n"
+           "\t\t--placement=interleave : the same, page by page round\n"
+           "\t\t     robin\n"
+           "\t\t--publish=lazy : in depth first search, keep right\n"
+           "\t\t     children on a private stack and only move some to\n"
+           "\t\t     the stealable deque when an idle thread asks (the\n"
+           "\t\t     default)\n"
+           "\t\t--publish=eager : push every right child on the deque\n"
+           "\t\t--steal=policy : which thread an idle thread tries to\n"
+           "\t\t     steal from first, before going through the rest:\n"
+           "\t\t     random      : a random one (the default)\n"
+           "\t\t     round-robin : the next one each time\n"
+           "\t\t     last        : the last one it stole from\n"
+           "\t\t     hier        : random, but threads on its own NUMA\n"
+           "\t\t                   node before any others. Needs\n"
+           "\t\t                   --topology, and is the default with it\n"
+           "\t\t--reduce=bins : before searching, print the count, sum,\n"
+           "\t\t     min and max of the tree's values and a histogram of\n"
+           "\t\t     them in this many bins (0 for none), worked out in\n"
+           "\t\t     parallel. Only for the pointer tree (no -c, -L, -B\n"
+           "\t\t     or -m bst)\n"
+           "\t\t--save-tree=image : write the built tree to the file\n"
+           "\t\t     image, to be mapped back with --load-tree. Implies -c\n"
+           "\t\t--load-tree : filename is a tree image; search the tree\n"
+           "\t\t     in it in place of building one. The image is mapped,\n"
+           "\t\t     and its links checked in one pass, so a corrupt one\n"
+           "\t\t     is rejected. No -b, -c, -L, -B, -j, --placement or\n"
+           "\t\t     -m bst\n"
+           "\t\t--load-tree=trust : the same without the check, so that\n"
+           "\t\t     mapping takes no time for any size of tree. Only for\n"
+           "\t\t     images --save-tree wrote\n\n");
 }
 
+#ifndef DFS_MPI
 int main(int argc, char **argv)
 {
-    int i, next_int;
-    int num_threads;
+    int c;
+    int num_threads, pool_threads;
+    double load_start, build_start, teardown_start;
     int *int_arr;
-    FILE* f;
+    intfile_t input, queries;
     char *fname;
-    int arr_space = 1024 * 100; //100kb by default
+    char *query_fname = NULL;
+    dfs_query_batch *batch = NULL;
+    int num_positional;
 
     int option_balanced = 0;
+    int option_compact = 0;
+    int option_build_threads = 0;
+    char *option_layout = NULL;
+    char *option_topology = NULL;
+    char *option_steal = NULL;
+    char *option_save_tree = NULL;
+    int option_load_tree = 0;
+    int option_trust_tree = 0;
+    double t0;
     int keyword_start_index = 1;
 
-    //Check args for -h flag, print help and exit if found.
-    for(i = 1; i < argc; i++){
-        if( strcmp(argv[i], "-h") == 0){
+    //Check args for flags. The leading '+' stops at the first non-option,
+    //so a negative search value is not taken for a flag.
+    static struct option long_options[] = {
+        {"stats", required_argument, NULL, 'S'},
+        {"hits", required_argument, NULL, 'H'},
+        {"topology", required_argument, NULL, 'T'},
+        {"placement", required_argument, NULL, 'P'},
+        {"publish", required_argument, NULL, 'U'},
+        {"steal", required_argument, NULL, 'W'},
+        {"reduce", required_argument, NULL, 'R'},
+        {"save-tree", required_argument, NULL, 'O'},
+        {"load-tree", optional_argument, NULL, 'I'},
+        {NULL, 0, NULL, 0}
+    };
+    while((c = getopt_long(argc, argv, "+hbcL:B:j:k:m:q:r:v", long_options, NULL)) != -1){
+        switch(c){
+        case 'h':
             printf("\n");
             printHelp(); 
             exit(0);
-        }
-        if( strcmp(argv[i], "-b") == 0){
+        case 'b':
             option_balanced = 1;
-            keyword_start_index = i+1;
+            break;
+        case 'c':
+            option_compact = 1;
+            break;
+        case 'L':
+            option_layout = optarg;
+            if(strcmp(optarg, "bfs") != 0 && strcmp(optarg, "veb") != 0){
+                printf(PROGNAME ": error: layout must be bfs or veb\n");
+                printUsage();
+                exit(1);
+            }
+            break;
+        case 'B':
+            DFS_BLOCK_SIZE = atoi(optarg);
+            if(DFS_BLOCK_SIZE < 2){
+                printf(PROGNAME ": error: block size must be at least 2\n");
+                printUsage();
+                exit(1);
+            }
+            option_compact = 1;
+            break;
+        case 'j':
+            option_build_threads = atoi(optarg);
+            if(option_build_threads < 1 || option_build_threads > DFS_THREAD_MAX){
+                printf(PROGNAME ": error: build threads must be between 1 and %d\n",
+                       DFS_THREAD_MAX);
+                printUsage();
+                exit(1);
+            }
+            break;
+        case 'k':
+            DFS_STEAL_CHUNK = atoi(optarg);
+            if(DFS_STEAL_CHUNK < 0){
+                printf(PROGNAME ": error: steal chunk must be nonnegative\n");
+                printUsage();
+                exit(1);
+            }
+            break;
+        case 'm':
+            if(strcmp(optarg, "dfs") == 0){
+                DFS_SEARCH_MODE = DFS_MODE_DFS;
+            } else if(strcmp(optarg, "bfs") == 0){
+                DFS_SEARCH_MODE = DFS_MODE_BFS;
+            } else if(strcmp(optarg, "best") == 0){
+                DFS_SEARCH_MODE = DFS_MODE_BEST;
+            } else if(strcmp(optarg, "bst") == 0){
+                DFS_SEARCH_MODE = DFS_MODE_BST;
+            } else {
+                printf(PROGNAME ": error: mode must be dfs, bfs, best or bst\n");
+                printUsage();
+                exit(1);
+            }
+            break;
+        case 'r':
+            DFS_REPEAT = atoi(optarg);
+            if(DFS_REPEAT < 1){
+                printf(PROGNAME ": error: repeats must be at least 1\n");
+                printUsage();
+                exit(1);
+            }
+            break;
+        case 'v':
+            DFS_STATS_FORMAT = DFS_STATS_TEXT;
+            break;
+        case 'H':
+            if(strcmp(optarg, "first") == 0){
+                DFS_HIT_MODE = DFS_HITS_FIRST;
+            } else if(strcmp(optarg, "all") == 0){
+                DFS_HIT_MODE = DFS_HITS_ALL;
+            } else {
+                printf(PROGNAME ": error: hits must be first or all\n");
+                printUsage();
+                exit(1);
+            }
+            break;
+        case 'T':
+            option_topology = optarg;
+            break;
+        case 'P':
+            if(strcmp(optarg, "first-touch") == 0){
+                DFS_PLACEMENT = DSP_NUMA_PLACE_FIRST_TOUCH;
+            } else if(strcmp(optarg, "interleave") == 0){
+                DFS_PLACEMENT = DSP_NUMA_PLACE_INTERLEAVE;
+            } else {
+                printf(PROGNAME ": error: placement must be first-touch or interleave\n");
+                printUsage();
+                exit(1);
+            }
+            break;
+        case 'O':
+            option_save_tree = optarg;
+            option_compact = 1;
+            break;
+        case 'I':
+            option_load_tree = 1;
+            if(optarg != NULL){
+                if(strcmp(optarg, "trust") != 0){
+                    printf(PROGNAME ": error: --load-tree takes no value but trust\n");
+                    printUsage();
+                    exit(1);
+                }
+                option_trust_tree = 1;
+            }
+            break;
+        case 'R':
+            DFS_REDUCE_BINS = atoi(optarg);
+            if(DFS_REDUCE_BINS < 0){
+                printf(PROGNAME ": error: histogram bins must be nonnegative\n");
+                printUsage();
+                exit(1);
+            }
+            break;
+        case 'W':
+            option_steal = optarg;
+            if(strcmp(optarg, "random") == 0){
+                DFS_STEAL_POLICY = DFS_STEAL_RANDOM;
+            } else if(strcmp(optarg, "round-robin") == 0){
+                DFS_STEAL_POLICY = DFS_STEAL_ROUND_ROBIN;
+            } else if(strcmp(optarg, "last") == 0){
+                DFS_STEAL_POLICY = DFS_STEAL_LAST;
+            } else if(strcmp(optarg, "hier") == 0){
+                DFS_STEAL_POLICY = DFS_STEAL_HIER;
+            } else {
+                printf(PROGNAME ": error: steal policy must be random, round-robin, last or hier\n");
+                printUsage();
+                exit(1);
+            }
+            break;
+        case 'U':
+            if(strcmp(optarg, "lazy") == 0){
+                DFS_PUBLISH_MODE = DFS_PUBLISH_LAZY;
+            } else if(strcmp(optarg, "eager") == 0){
+                DFS_PUBLISH_MODE = DFS_PUBLISH_EAGER;
+            } else {
+                printf(PROGNAME ": error: publish must be lazy or eager\n");
+                printUsage();
+                exit(1);
+            }
+            break;
+        case 'S':
+            if(strcmp(optarg, "text") == 0){
+                DFS_STATS_FORMAT = DFS_STATS_TEXT;
+            } else if(strcmp(optarg, "json") == 0){
+                DFS_STATS_FORMAT = DFS_STATS_JSON;
+            } else {
+                printf(PROGNAME ": error: stats format must be text or json\n");
+                printUsage();
+                exit(1);
+            }
+            break;
+        case 'q':
+            query_fname = optarg;
+            break;
+        default:
+            printUsage();
+            exit(1);
         }
     }
+    keyword_start_index = optind;
 
     //Debug args
     /*printf("keyword index = %d\n", keyword_start_index);
@@ -106,7 +713,80 @@ int main(int argc, char **argv)
         printf("argv[%d] = %s\n", i, argv[i]);
     }*/
 
-    if((argc - keyword_start_index) != 3){
+    if(option_layout != NULL && !option_balanced){
+        printf(PROGNAME ": error: -L layouts are for the balanced tree (-b)\n");
+        printUsage();
+        exit(1);
+    }
+
+    if(DFS_BLOCK_SIZE > 0 && option_layout != NULL && strcmp(option_layout, "bfs") == 0){
+        printf(PROGNAME ": error: leaf blocks (-B) need a compact layout, not -L bfs\n");
+        printUsage();
+        exit(1);
+    }
+
+    if(DFS_SEARCH_MODE == DFS_MODE_BST &&
+       (option_balanced || option_compact || option_layout != NULL)){
+        printf(PROGNAME ": error: -m bst builds a sorted index, not a tree; "
+                        "no -b, -c, -L or -B\n");
+        printUsage();
+        exit(1);
+    }
+
+    if(DFS_REDUCE_BINS >= 0 && (option_compact || option_layout != NULL ||
+                                DFS_SEARCH_MODE == DFS_MODE_BST || option_load_tree)){
+        printf(PROGNAME ": error: --reduce works on the pointer tree; "
+                        "no -c, -L, -B, -m bst or --load-tree\n");
+        exit(1);
+    }
+
+    if(option_save_tree != NULL && option_layout != NULL && strcmp(option_layout, "bfs") == 0){
+        printf(PROGNAME ": error: --save-tree needs a compact layout, not -L bfs\n");
+        printUsage();
+        exit(1);
+    }
+
+    if(option_load_tree &&
+       (option_balanced || option_compact || option_layout != NULL ||
+        option_build_threads > 0 || DFS_PLACEMENT != DSP_NUMA_PLACE_NONE ||
+        DFS_SEARCH_MODE == DFS_MODE_BST)){
+        printf(PROGNAME ": error: --load-tree maps a tree already built; no -b, -c, -L, "
+                        "-B, -j, --placement, --save-tree or -m bst\n");
+        printUsage();
+        exit(1);
+    }
+
+    if(DFS_STEAL_POLICY == DFS_STEAL_HIER && option_topology == NULL){
+        printf(PROGNAME ": error: --steal=hier needs --topology\n");
+        printUsage();
+        exit(1);
+    }
+    if(option_topology != NULL && option_steal == NULL) DFS_STEAL_POLICY = DFS_STEAL_HIER;
+
+    if(DFS_PLACEMENT != DSP_NUMA_PLACE_NONE && option_topology == NULL){
+        printf(PROGNAME ": error: --placement needs --topology\n");
+        printUsage();
+        exit(1);
+    }
+
+    //Only the compact tree's node arena is placed.
+    if(DFS_PLACEMENT != DSP_NUMA_PLACE_NONE && !option_compact &&
+       !(option_layout != NULL && strcmp(option_layout, "veb") == 0)){
+        printf(PROGNAME ": error: --placement spreads the compact tree's node array; "
+                        "it needs -c, -B or -L veb\n");
+        printUsage();
+        exit(1);
+    }
+
+    if(DFS_HIT_MODE == DFS_HITS_ALL && query_fname != NULL){
+        printf(PROGNAME ": error: --hits=all is for a single search value, not -q\n");
+        printUsage();
+        exit(1);
+    }
+
+    //A query file takes the place of the search value.
+    num_positional = (query_fname == NULL) ? 3 : 2;
+    if((argc - keyword_start_index) != num_positional){
         printArgError();
         printUsage();
         exit(1);
@@ -114,8 +794,10 @@ int main(int argc, char **argv)
 
     //Set search values
     fname = argv[keyword_start_index];
-    search_val = atoi(argv[keyword_start_index+1]);
-    num_threads = atoi(argv[keyword_start_index+2]);
+    if(query_fname == NULL){
+        search_val = atoi(argv[keyword_start_index+1]);
+    }
+    num_threads = atoi(argv[keyword_start_index+num_positional-1]);
 
     if(num_threads < 0 || num_threads > DFS_THREAD_MAX){
         printArgError();
@@ -129,64 +811,183 @@ int main(int argc, char **argv)
 
     //------------- Read in data file ----------------
 
-    //Open file.
-    if((f = fopen(fname, "r")) == NULL){
-        perror(PROGNAME ": error: problem opening file");
-        exit(1);
-    }
+    //Map a binary .i32 file, or parse a text file with all processors.
+    //A tree image has the values in it, and is mapped in place of building.
+    load_start = dfs_stats_now();
+    if(!option_load_tree){
+        if(intfile_load(&input, fname, 0) != 0){
+            perror(PROGNAME ": error: problem reading file");
+            exit(1);
+        }
 
-    //Allocate initial array for the values.
-    int_arr = (int*)malloc(sizeof(int) * arr_space);
-    if(int_arr == NULL){
-        perror(PROGNAME ": error: error allocating memory");
-        exit(1);
+        if(input.count == 0){
+            fprintf(stderr, PROGNAME ": error: no values to process!\n");
+            exit(1);
+        }
+        if(input.count > INT_MAX){
+            fprintf(stderr, PROGNAME ": error: too many values to process!\n");
+            exit(1);
+        }
+
+        DFS_TREE_SIZE = input.count;
+    } else {
+        memset(&input, 0, sizeof(input));
     }
+    int_arr = input.data;
 
-    //Scan to get values, growing array if needed.
-    fseek(f, 0, SEEK_SET);
-    for(i = 0; (fscanf(f,"%d", &next_int) != EOF); i++){
-        if(i == arr_space){
-            arr_space *= 2;
-            int_arr = (int*)realloc(int_arr, sizeof(int) * arr_space);
-            if(int_arr == NULL){
-                perror(PROGNAME ": error: error reallocating memory for array");
-                exit(1);
-            }
+    if(query_fname != NULL){
+        if(intfile_load(&queries, query_fname, 0) != 0){
+            perror(PROGNAME ": error: problem reading query file");
+            exit(1);
+        }
+        if(queries.count == 0){
+            fprintf(stderr, PROGNAME ": error: no queries to process!\n");
+            exit(1);
         }
-        int_arr[i] = next_int;
+        batch = query_batch_create(queries.data, queries.count);
     }
-    fclose(f);
-
-    if(i == 0){
-        fprintf(stderr, PROGNAME ": error: no values to process!\n");
-        exit(1);
+    if(!option_load_tree)
+        fprintf(stderr, PROGNAME ": loaded %lu values in %.9f seconds\n",
+                input.count, dfs_stats_now() - load_start);
+
+
+    //Start the worker threads once, for the parallel build and every
+    //search below.
+    if(option_topology != NULL){
+        search_numa = (dsp_numa_t *)malloc(sizeof(dsp_numa_t));
+        if(search_numa == NULL ||
+           dsp_numa_load(search_numa, (strcmp(option_topology, "sys") == 0) ?
+                                      NULL : option_topology) != 0){
+            perror(PROGNAME ": error: problem reading topology");
+            exit(1);
+        }
     }
-
-    DFS_TREE_SIZE = i;
+    pool_threads = (num_threads == 0) ? DFS_THREAD_MAX : num_threads;
+    if(option_build_threads > pool_threads) pool_threads = option_build_threads;
+    search_setup(pool_threads);
+    DFS_PLACE_THREADS = (option_build_threads > 0) ? option_build_threads : pool_threads;
 
 
     //------------- Build Tree -------------------
 
-    tree *t;
-    if(option_balanced){
-        prog_debug(1, PROGNAME ": building balanced tree from input values\n");
-        t = makeBalancedTreeFromArray(int_arr[0], int_arr, DFS_TREE_SIZE);
+    build_start = dfs_stats_now();
+    dfs_tree t;
+    t.ptree = NULL;
+    t.ctree = NULL;
+    t.itree = NULL;
+    t.etree = NULL;
+    t.root = 0;
+    if(option_load_tree){
+        t.layout = DFS_LAYOUT_COMPACT;
+        prog_debug(1, PROGNAME ": mapping tree image %s\n", fname);
+        t.ctree = mapCTreeImage(fname, !option_trust_tree);
+        DFS_TREE_SIZE = t.ctree->node_count;
+    } else if(DFS_SEARCH_MODE == DFS_MODE_BST){
+        //The index comes out the same for any number of threads, so use
+        //them all unless told otherwise.
+        t.layout = DFS_LAYOUT_SORTED;
+        prog_debug(1, PROGNAME ": building sorted index from input values\n");
+        t.etree = makeSortedETreeFromArray(int_arr, DFS_TREE_SIZE,
+                      (option_build_threads > 0) ? option_build_threads : pool_threads);
+        intfile_release(&input);
+        int_arr = NULL;
+    } else if(option_layout != NULL && strcmp(option_layout, "bfs") == 0){
+        //The input array already is the balanced tree in BFS order.
+        t.layout = DFS_LAYOUT_IMPLICIT;
+        prog_debug(1, PROGNAME ": using input values as implicit balanced tree\n");
+        t.itree = makeBfsITreeFromArray(int_arr, DFS_TREE_SIZE);
+    } else if(option_layout != NULL && strcmp(option_layout, "veb") == 0){
+        t.layout = DFS_LAYOUT_COMPACT;
+        prog_debug(1, PROGNAME ": building van Emde Boas balanced tree from input values\n");
+        t.ctree = makeVebCTreeFromArray(int_arr, DFS_TREE_SIZE);
+        intfile_release(&input);
+        int_arr = NULL;
+    } else if(option_compact){
+        t.layout = DFS_LAYOUT_COMPACT;
+        if(option_build_threads > 0){
+            prog_debug(1, PROGNAME ": building compact tree with %d threads\n",
+                       option_build_threads);
+            t.ctree = makeParallelCTreeFromArray(option_balanced, int_arr[0], int_arr,
+                                                 DFS_TREE_SIZE, option_build_threads);
+        } else if(option_balanced){
+            prog_debug(1, PROGNAME ": building balanced compact tree from input values\n");
+            t.ctree = makeBalancedCTreeFromArray(int_arr[0], int_arr, DFS_TREE_SIZE);
+        } else {
+            prog_debug(1, PROGNAME ": building random compact tree from input values\n");
+            t.ctree = makeRandomCTreeFromArray(int_arr[0], int_arr, DFS_TREE_SIZE);
+        }
+        //Values are stored inline, so the input array is no longer needed.
+        intfile_release(&input);
+        int_arr = NULL;
     } else {
-        prog_debug(1, PROGNAME ": building random tree from input values\n");
-        t = makeRandomTreeFromArray(int_arr[0], int_arr, DFS_TREE_SIZE);
+        t.layout = DFS_LAYOUT_POINTER;
+        if(option_build_threads > 0){
+            prog_debug(1, PROGNAME ": building tree with %d threads\n",
+                       option_build_threads);
+            t.ptree = makeParallelTreeFromArray(option_balanced, int_arr[0], int_arr,
+                                                DFS_TREE_SIZE, option_build_threads);
+        } else if(option_balanced){
+            prog_debug(1, PROGNAME ": building balanced tree from input values\n");
+            t.ptree = makeBalancedTreeFromArray(int_arr[0], int_arr, DFS_TREE_SIZE);
+        } else {
+            prog_debug(1, PROGNAME ": building random tree from input values\n");
+            t.ptree = makeRandomTreeFromArray(int_arr[0], int_arr, DFS_TREE_SIZE);
+        }
+    }
+
+
+    if(option_load_tree)
+        fprintf(stderr, PROGNAME ": mapped tree of %d nodes in %.9f seconds\n",
+                DFS_TREE_SIZE, dfs_stats_now() - build_start);
+    else
+        fprintf(stderr, PROGNAME ": built tree in %.9f seconds\n", dfs_stats_now() - build_start);
+
+    //Flatten the bottom of the tree into leaf blocks for SIMD scanning.
+    if(DFS_BLOCK_SIZE > 0){
+        if(!ctree_make_blocks(t.ctree, DFS_BLOCK_SIZE)){
+            perror(PROGNAME ": error: error allocating leaf blocks");
+            exit(1);
+        }
+        dsp_simd_init(NULL);
+        fprintf(stderr, PROGNAME ": %lu leaf blocks holding %lu values, %s scan\n",
+                t.ctree->block_count,
+                (t.ctree->block_count > 0) ? (unsigned long)(
+                    t.ctree->blocks[t.ctree->block_count-1].offset +
+                    t.ctree->blocks[t.ctree->block_count-1].length) : 0UL,
+                dsp_simd_name());
     }
 
+    //Save the tree, leaf blocks and all, for --load-tree.
+    if(option_save_tree != NULL){
+        t0 = dfs_stats_now();
+        if(ctree_save(t.ctree, option_save_tree) != 0){
+            perror(PROGNAME ": error: problem writing tree image");
+            exit(1);
+        }
+        fprintf(stderr, PROGNAME ": saved tree image in %.9f seconds\n", dfs_stats_now() - t0);
+    }
 
     //tree_print(t, stdout);
     //Print tree using function pointer scheme. Left as an example of
     //how to use tree_visit.
     if(DFS_DEBUG_TREE > 0){
-        treenode_func func = printNode;
-        tree_visit(t, func, (void *)stdout);
+        if(t.layout == DFS_LAYOUT_COMPACT){
+            ctreenode_func func = printCNode;
+            ctree_visit(t.ctree, func, (void *)stdout);
+        } else if(t.layout == DFS_LAYOUT_IMPLICIT){
+            itreenode_func func = printINode;
+            itree_visit(t.itree, func, (void *)stdout);
+        } else if(t.layout == DFS_LAYOUT_POINTER){
+            treenode_func func = printNode;
+            tree_visit(t.ptree, func, (void *)stdout);
+        }
     }
 
 
 
+    if(DFS_REDUCE_BINS >= 0)
+        run_reductions(&t, (num_threads == 0) ? pool_threads : num_threads);
+
     //--------------- Search The Tree -----------------
 
     //Single DFS search using a pointer to the findVal function. For fun.
@@ -196,17 +997,33 @@ int main(int argc, char **argv)
     //Call the threaded search algorithm.
     if(num_threads == 0){
         for(num_threads = 1; num_threads <= DFS_THREAD_MAX; num_threads *= 2){
-                prog_debug(1, PROGNAME ": starting search_tree_for_val...\n");
-                search_tree_for_val(t, num_threads, search_val);
+            run_searches(&t, num_threads, batch);
         }
     } else {
-                prog_debug(1, PROGNAME ": starting search_tree_for_val...\n");
-                search_tree_for_val(t, num_threads, search_val);
+            run_searches(&t, num_threads, batch);
     }
 
+    //------------- Tear Down -------------------
+
+    teardown_start = dfs_stats_now();
+    if(batch != NULL){
+        query_batch_destroy(batch);
+        intfile_release(&queries);
+    }
+    search_teardown();
+    free_dfs_tree(&t);
+    intfile_release(&input);
+    fprintf(stderr, PROGNAME ": tore down in %.9f seconds\n", dfs_stats_now() - teardown_start);
+
 
     return 0;
 }
+#else
+int main(int argc, char **argv)
+{
+    return mpi_main(argc, argv);
+}
+#endif
 
 tree *makeRandomTreeFromArray(int randseed, int *array, int array_size)
 {
@@ -379,220 +1196,1621 @@ tree *makeBalancedTreeFromArray(int randseed, int *array, int array_size)
     return t;
 }
 
-int search_tree_for_val(tree *t, int num_threads, int val)
+//Allocate a compact tree with room for array_size nodes, its arena
+//spread over the NUMA nodes if asked for.
+ctree *alloc_ctree_arena(int array_size)
 {
-    int i;
-    treenode *n;
-    dsp_stack_t *s;
-    int *thread_id;
-    int threads_ready = 1;
-    int node_val;
-
-    n = t->head;
-    if(n == NULL) return -1;
-
-    //Set globals for new search...
-    DFS_NUM_THREADS = num_threads;
-    search_val = val;
-    val_found = 0;
+    ctree *t;
 
-    //Allocate threads and thread id's
-    threads = (pthread_t *)malloc(sizeof(pthread_t) * num_threads);
-    thread_id = (int *)malloc(sizeof(int) * num_threads);
-    if(threads == NULL || thread_id == NULL){
-        perror(PROGNAME "error: error allocating threads");
+    t = (ctree*)malloc(sizeof(ctree));
+    if(t == NULL){
+        perror(PROGNAME ": error: error allocating memory");
         exit(1);
     }
-
-    //Allocate thread work stacks
-    thread_work_stack = (dsp_stack_t **)malloc(sizeof(dsp_stack_t *) * num_threads);
-    if(thread_work_stack == NULL){
-        perror(PROGNAME "error: error allocating thread_stacks");
+    ctree_init(t);
+    if(!ctree_alloc(t, array_size)){
+        perror(PROGNAME ": error: error allocating node arena");
         exit(1);
     }
-    for(i = 0; i < num_threads; i++){
-        thread_work_stack[i] = dsp_stack_create(t->node_count);
-    }
+    dsp_numa_place(search_pool, DFS_PLACE_THREADS, t->nodes,
+                   sizeof(ctreenode) * array_size, DFS_PLACEMENT);
+    return t;
+}
+
+//Map a tree image written with --save-tree, checking its links if check
+//is set.
+ctree *mapCTreeImage(const char *fname, int check)
+{
+    ctree *t;
 
-    //Allocate thread work stack mutexes
-    thread_work_stack_mutex = (pthread_mutex_t *)malloc(sizeof(pthread_mutex_t) * num_threads);
-    if(thread_work_stack_mutex == NULL){
-        perror(PROGNAME "error: error allocating thread_stacks");
+    t = (ctree*)malloc(sizeof(ctree));
+    if(t == NULL){
+        perror(PROGNAME ": error: error allocating memory");
         exit(1);
     }
-
-    //Initialize threads
-    for(i = 0; i < num_threads; i++){
-        thread_id[i] = i;
-        dsp_stack_init(thread_work_stack[i], t->node_count);
-        pthread_mutex_init(&thread_work_stack_mutex[i], NULL);
+    if(ctree_map(t, fname, check) != 0){
+        perror(PROGNAME ": error: problem mapping tree image");
+        exit(1);
     }
+    if(t->node_count == 0 || t->node_count > INT_MAX){
+        fprintf(stderr, PROGNAME ": error: tree image holds %lu nodes\n", t->node_count);
+        exit(1);
+    }
+    return t;
+}
 
-
-    //Spread initial work across other thread work stacks
-    while(n != NULL && threads_ready < num_threads) {
-        if(n->right != NULL) {
-            dsp_stack_push(thread_work_stack[threads_ready], n->right);
-            threads_ready++;
+ctree *makeRandomCTreeFromArray(int randseed, int *array, int array_size)
+{
+    ctree *t;
+    ctreenode *n, *pnode;
+    uint32_t i, p;
+    int r;
+
+    //Allocate tree and its node arena.
+    t = alloc_ctree_arena(array_size);
+
+    //Same sequence of random choices as makeRandomTreeFromArray, so both
+    //layouts produce the same tree shape for the same seed. A node with
+    //both links filled plays the part of a NULL slot in the available list.
+    srand(randseed);
+    for(i = 0; i < (uint32_t)array_size; i++){
+
+        n = &t->nodes[i];
+        ctreenode_init(n, array[i]);
+        if(i == 0){
+            t->head = 0;
+            continue;
         }
-        //Heck, we might get lucky and find it in this predistribution step
-        if(n->data != NULL){
-            node_val = *((int *)n->data);
-            if(node_val == search_val){
-                thread_debug(1, "main thread: found value during predistribution step!\n");
-                printf("%d\t\t%d\t\t%f\t\t%d\n", DFS_TREE_SIZE, num_threads, 0.0, 1);
-                return 0;
-            }
+
+        //Select parent randomly until found
+        pnode = NULL;
+        while(pnode == NULL){
+            p = randint(i);
+            if(p >= i) continue;
+            pnode = &t->nodes[p];
+            if(pnode->left != CTREE_NIL && pnode->right != CTREE_NIL)
+                pnode = NULL;
         }
-        n = n->left;
-    }
 
-    thread_debug(1, "main thread: predistribution step checked %d nodes\n", threads_ready - 1);
+        tree_debug(2, "Parent chosen for node %u : %u\n", i, p);
 
-    //Put current node (post distribution) on first thread's work stack.
-    s = thread_work_stack[0];
-    dsp_stack_push(s, n);
+        //Randomly select left or right child link to attach to.
+        //Try other child if the selected link is not available.
+        r = randint(2);
+        if(r == 0){
+            if(pnode->left == CTREE_NIL)
+                pnode->left = i;
+            else
+                pnode->right = i;
+        } else {
+            if(pnode->right == CTREE_NIL)
+                pnode->right = i;
+            else
+                pnode->left = i;
+        }
+    }
+    return t;
+}
 
+ctree *makeBalancedCTreeFromArray(int randseed, int *array, int array_size)
+{
+    ctree *t;
+    uint32_t i, n;
+
+    t = alloc_ctree_arena(array_size);
+
+    //Children of node i are 2i+1 and 2i+2, matching the parent (i-1)/2
+    //rule used by makeBalancedTreeFromArray.
+    n = (uint32_t)array_size;
+    for(i = 0; i < n; i++){
+        ctreenode_init(&t->nodes[i], array[i]);
+        if((uint64_t)2*i + 1 < n) t->nodes[i].left = 2*i + 1;
+        if((uint64_t)2*i + 2 < n) t->nodes[i].right = 2*i + 2;
+    }
+    t->head = 0;
+    return t;
+}
 
-    //Timing vars
-    float search_time;
-    struct timeval t0, t1;
-    gettimeofday(&t0, NULL);
+//Build the random or balanced compact tree with num_threads threads of
+//the search pool. See treebuild.h for how the random tree is put together.
+ctree *makeParallelCTreeFromArray(int balanced, int randseed, int *array,
+                                  int array_size, int num_threads)
+{
+    ctree *t = alloc_ctree_arena(array_size);
 
+    if(balanced)
+        treebuild_balanced_ctree(search_pool, num_threads, array, t);
+    else
+        treebuild_random_ctree(search_pool, num_threads, (uint32_t)randseed, array, t);
+    return t;
+}
 
-    prog_debug(1, PROGNAME ": starting %d threads\n", num_threads);
+//Same, as a pointer tree. The compact tree is built first for its shape.
+tree *makeParallelTreeFromArray(int balanced, int randseed, int *array,
+                                int array_size, int num_threads)
+{
+    ctree *ct;
+    tree *t;
 
-    //Create threads
-    for(i = 0; i < num_threads; i++){
-        pthread_create(&threads[i], NULL, thread_traverse_tree, &thread_id[i]);
+    ct = makeParallelCTreeFromArray(balanced, randseed, array, array_size, num_threads);
+    t = treebuild_ptree(search_pool, num_threads, ct, array);
+    if(t == NULL){
+        perror(PROGNAME ": error: error allocating memory");
+        exit(1);
     }
+    ctree_free(ct);
+    free(ct);
+    return t;
+}
 
-    //Join threads 
-    for(i = 0; i < num_threads; i++){
-        pthread_join(threads[i], NULL);
+//Give the nodes of the subtree of the given height under BFS index root
+//their van Emde Boas positions, counting up from *next: the top half of the
+//levels first, then each subtree hanging off the top, each laid out the
+//same way. Nodes at index n or beyond don't exist and are skipped.
+void veb_assign(uint64_t root, int height, uint64_t n, uint32_t *pos, uint32_t *next)
+{
+    int top_height, bottom_height;
+    uint64_t first, k, count;
+
+    if(root >= n) return;
+    if(height == 1){
+        pos[root] = (*next)++;
+        return;
     }
 
-    gettimeofday(&t1, NULL);
-    search_time = (float)(t1.tv_sec - t0.tv_sec) + ((float)(t1.tv_usec - t0.tv_usec)/1000000.0);
+    top_height = height / 2;
+    bottom_height = height - top_height;
+    veb_assign(root, top_height, n, pos, next);
 
+    //The bottom subtree roots are the descendants of root top_height levels
+    //down, which sit next to each other in BFS order.
+    first = ((root + 1) << top_height) - 1;
+    count = (uint64_t)1 << top_height;
+    for(k = first; k < first + count && k < n; k++){
+        veb_assign(k, bottom_height, n, pos, next);
+    }
+}
 
-    if(val_found == 0){
-        prog_debug(1, PROGNAME ": value not found in tree!\n");
-    } else {
-        prog_debug(1, PROGNAME ": value found!\n");
+//Build the balanced tree (same shape as makeBalancedTreeFromArray) as a
+//compact tree whose arena is in van Emde Boas order, so any subtree of
+//height h sits in about 2^h consecutive nodes. Node ids are arena
+//positions, not input positions.
+ctree *makeVebCTreeFromArray(int *array, int array_size)
+{
+    ctree *t;
+    uint32_t *pos;
+    uint32_t next = 0;
+    uint64_t i, n = array_size;
+    int height = 0;
+    ctreenode *node;
+
+    pos = (uint32_t *)malloc(sizeof(uint32_t) * n);
+    if(pos == NULL){
+        perror(PROGNAME ": error: error allocating memory");
+        exit(1);
     }
-    prog_debug(1, PROGNAME ": all threads complete\n");
+    t = alloc_ctree_arena(array_size);
 
-    //printf("size\t\tthreads\t\ttime\t\tfound\n");
-    printf("%d\t\t%d\t\t%f\t\t%d\n", DFS_TREE_SIZE, num_threads, search_time, val_found);
+    while(((uint64_t)1 << height) - 1 < n) height++;
+    veb_assign(0, height, n, pos, &next);
 
-    //Clean up
-    free(threads);
-    free(thread_id);
-    for(i = 0; i < num_threads; i++){
-        dsp_stack_destroy(thread_work_stack[i]);
+    for(i = 0; i < n; i++){
+        node = &t->nodes[pos[i]];
+        ctreenode_init(node, array[i]);
+        if(2*i + 1 < n) node->left = pos[2*i + 1];
+        if(2*i + 2 < n) node->right = pos[2*i + 2];
     }
-    free(thread_work_stack);
-    free(thread_work_stack_mutex);
+    t->head = pos[0];
 
-    return 0;
+    free(pos);
+    return t;
 }
 
-void *thread_traverse_tree(void *tid)
+//The balanced tree in BFS (Eytzinger) order is the input array itself,
+//so there is nothing to build. The tree points into array.
+itree *makeBfsITreeFromArray(int *array, int array_size)
 {
-    int id = *((int *)tid);
-    dsp_stack_t *s = thread_work_stack[id];
-    pthread_mutex_t *dsp_stack_mutex = &thread_work_stack_mutex[id];
-    treenode *n;
-    int node_val;
-    int nodes_processed = 0;
-
-    thread_debug(1, "thread %d: started...\n", id);
+    itree *t;
 
-    while(1){
-        //Check to see if we are done
-        if(val_found) break;
+    t = (itree*)malloc(sizeof(itree));
+    if(t == NULL){
+        perror(PROGNAME ": error: error allocating memory");
+        exit(1);
+    }
+    itree_init(t, array, array_size);
+    return t;
+}
 
-        //Get next node from my stack
-        pthread_mutex_lock(dsp_stack_mutex);
-            n = dsp_stack_pop(s);
-        pthread_mutex_unlock(dsp_stack_mutex);
+//Bulk load the sorted index over the input values with num_threads threads.
+etree *makeSortedETreeFromArray(int *array, int array_size, int num_threads)
+{
+    etree *t;
 
-        //If my stack is empty, get next available node from another stack.
-        if(n == NULL){
-            n = get_next_available_treenode(id);
-        }
+    t = (etree *)malloc(sizeof(etree));
+    if(t == NULL || !treebuild_etree(search_pool, num_threads, array, array_size, t)){
+        perror(PROGNAME ": error: error allocating memory");
+        exit(1);
+    }
+    return t;
+}
 
-        //If no work found in any other thread's stack, exit...
-        if(n == NULL){
-            break;
-        }
+//Layout independent node access, for the code outside the hot loops.
+void *dfs_node_left(dfs_tree *t, void *n)
+{
+    ctreenode *cn;
+    unsigned long i;
+
+    switch(t->layout){
+    case DFS_LAYOUT_COMPACT:
+        cn = (ctreenode *)n;
+        if(cn->left == CTREE_NIL || ctreenode_isblock(cn)) return NULL;
+        return &t->ctree->nodes[cn->left];
+    case DFS_LAYOUT_IMPLICIT:
+        i = ITREE_LEFT((int *)n - t->itree->values);
+        return (i < t->itree->node_count) ? &t->itree->values[i] : NULL;
+    default:
+        return ((treenode *)n)->left;
+    }
+}
 
-        //Go depth first in searching, going to the left child
-        //and pushing the right child onto my stack.
-        while(n != NULL){
+void *dfs_node_right(dfs_tree *t, void *n)
+{
+    ctreenode *cn;
+    unsigned long i;
+
+    switch(t->layout){
+    case DFS_LAYOUT_COMPACT:
+        cn = (ctreenode *)n;
+        if(cn->right == CTREE_NIL || ctreenode_isblock(cn)) return NULL;
+        return &t->ctree->nodes[cn->right];
+    case DFS_LAYOUT_IMPLICIT:
+        i = ITREE_RIGHT((int *)n - t->itree->values);
+        return (i < t->itree->node_count) ? &t->itree->values[i] : NULL;
+    default:
+        return ((treenode *)n)->right;
+    }
+}
 
-            nodes_processed++;
+//Returns 0 if the node carries no value. The root of a leaf block carries
+//the whole block, which has to be scanned by a worker.
+int dfs_node_value(dfs_tree *t, void *n, int *val)
+{
+    switch(t->layout){
+    case DFS_LAYOUT_COMPACT:
+        if(ctreenode_isblock((ctreenode *)n)) return 0;
+        *val = ((ctreenode *)n)->value;
+        return 1;
+    case DFS_LAYOUT_IMPLICIT:
+        *val = *((int *)n);
+        return 1;
+    default:
+        if(((treenode *)n)->data == NULL) return 0;
+        *val = *((int *)((treenode *)n)->data);
+        return 1;
+    }
+}
 
-            //Make sure we are not done.
-            if(val_found) break;
+long dfs_node_id(dfs_tree *t, void *n)
+{
+    switch(t->layout){
+    case DFS_LAYOUT_COMPACT:
+        return (ctreenode *)n - t->ctree->nodes;
+    case DFS_LAYOUT_IMPLICIT:
+        return (int *)n - t->itree->values;
+    default:
+        return ((treenode *)n)->id;
+    }
+}
+
+int dfs_node_isblock(dfs_tree *t, void *n)
+{
+    return (t->layout == DFS_LAYOUT_COMPACT && ctreenode_isblock((ctreenode *)n));
+}
+
+void *dfs_tree_head(dfs_tree *t)
+{
+    switch(t->layout){
+    case DFS_LAYOUT_COMPACT:
+        if(t->ctree->head == CTREE_NIL) return NULL;
+        return &t->ctree->nodes[t->ctree->head];
+    case DFS_LAYOUT_IMPLICIT:
+        return (t->root >= t->itree->node_count) ? NULL : &t->itree->values[t->root];
+    case DFS_LAYOUT_SORTED:
+        return (t->etree->node_count == 0) ? NULL : &t->etree->keys[1];
+    default:
+        return t->ptree->head;
+    }
+}
+
+void free_dfs_tree(dfs_tree *t)
+{
+    switch(t->layout){
+    case DFS_LAYOUT_COMPACT:
+        ctree_free(t->ctree);
+        free(t->ctree);
+        break;
+    case DFS_LAYOUT_IMPLICIT:
+        free(t->itree);
+        break;
+    case DFS_LAYOUT_SORTED:
+        etree_free(t->etree);
+        free(t->etree);
+        break;
+    default:
+        if(!tree_free(t->ptree)){
+            perror(PROGNAME ": error: error allocating memory");
+            exit(1);
+        }
+        free(t->ptree);
+    }
+}
+
+//Create the worker pool and the per thread state for up to max_threads
+//threads. Searches reuse all of it, so thread creation is timed and
+//reported here, apart from the search times.
+void search_setup(int max_threads)
+{
+    int i, j, failed;
+    double t0;
+
+    search_max_threads = max_threads;
+
+    //Pick the scan kernel here, before any worker can reach dsp_scan_eq.
+    //Otherwise the first workers to scan would all pick it at once.
+    dsp_simd_init(NULL);
+
+    t0 = dfs_stats_now();
+    search_pool = dsp_pool_create(max_threads);
+    if(search_pool == NULL){
+        perror(PROGNAME ": error: error creating thread pool");
+        exit(1);
+    }
+    if(search_setup_report)
+        fprintf(stderr, PROGNAME ": created %d threads in %.9f seconds\n", max_threads,
+                dfs_stats_now() - t0);
+
+    if(search_numa != NULL){
+        failed = dsp_numa_pin_pool(search_numa, search_pool);
+        fprintf(stderr, PROGNAME ": %d NUMA nodes, %d of %d threads pinned\n",
+                search_numa->num_nodes, max_threads - failed, max_threads);
+        if(DFS_DEBUG_PROGRESS > 0) dsp_numa_print(search_numa, stderr);
+    }
+
+    //Allocate thread work deques. They grow on demand, so there is no need
+    //to size them for the whole tree up front.
+    thread_work_deque = (dsp_deque_t **)malloc(sizeof(dsp_deque_t *) * max_threads);
+    if(thread_work_deque == NULL){
+        perror(PROGNAME "error: error allocating thread_deques");
+        exit(1);
+    }
+    for(i = 0; i < max_threads; i++){
+        thread_work_deque[i] = dsp_deque_create(0);
+        if(thread_work_deque[i] == NULL){
+            perror(PROGNAME "error: error allocating thread_deques");
+            exit(1);
+        }
+    }
+    if(posix_memalign((void **)&thread_private_work, DSP_CACHELINE,
+                      sizeof(dfs_private_work) * max_threads) != 0){
+        fprintf(stderr, PROGNAME ": error: error allocating private work stacks\n");
+        exit(1);
+    }
+    for(i = 0; i < max_threads; i++){
+        atomic_init(&thread_private_work[i].hungry, 0);
+        dsp_stack_init(&thread_private_work[i].stack, 0);
+        if(thread_private_work[i].stack.buf == NULL){
+            perror(PROGNAME ": error: error allocating private work stacks");
+            exit(1);
+        }
+    }
+
+    //Allocate per thread victim selection state, each thread with its own
+    //random stream.
+    if(posix_memalign((void **)&thread_thieves, DSP_CACHELINE,
+                      sizeof(dfs_thief) * max_threads) != 0){
+        fprintf(stderr, PROGNAME ": error: error allocating thief state\n");
+        exit(1);
+    }
+    for(i = 0; i < max_threads; i++){
+        dsp_rng_seed(&thread_thieves[i].rng, i, 0);
+    }
+
+    //Allocate per thread counters
+    thread_stats = dfs_stats_create(max_threads);
+    if(thread_stats == NULL){
+        fprintf(stderr, PROGNAME ": error: error allocating thread stats\n");
+        exit(1);
+    }
+
+    //Allocate BFS frontiers, which also grow as needed, and the best first
+    //priority queue.
+    for(i = 0; i < 2; i++){
+        if(posix_memalign((void **)&bfs_frontier[i], DSP_CACHELINE,
+                          sizeof(dfs_frontier) * max_threads) != 0){
+            fprintf(stderr, PROGNAME ": error: error allocating frontiers\n");
+            exit(1);
+        }
+        for(j = 0; j < max_threads; j++){
+            bfs_frontier[i][j].nodes = NULL;
+            bfs_frontier[i][j].count = 0;
+            bfs_frontier[i][j].size = 0;
+        }
+    }
+    bfs_offsets = (long *)malloc(sizeof(long) * (max_threads + 1));
+    best_queue = dsp_mq_create(DFS_BEST_QUEUES_PER_THREAD * max_threads);
+    if(bfs_offsets == NULL || best_queue == NULL){
+        perror(PROGNAME ": error: error allocating search state");
+        exit(1);
+    }
+
+    //Allocate per thread hit buffers. They grow on the first hit.
+    if(posix_memalign((void **)&thread_hits, DSP_CACHELINE,
+                      sizeof(dfs_hit_buffer) * max_threads) != 0){
+        fprintf(stderr, PROGNAME ": error: error allocating hit buffers\n");
+        exit(1);
+    }
+    for(i = 0; i < max_threads; i++){
+        thread_hits[i].ids = NULL;
+        thread_hits[i].count = 0;
+        thread_hits[i].size = 0;
+    }
+}
+
+void search_teardown()
+{
+    int i, j;
+
+    dsp_pool_destroy(search_pool);
+    for(i = 0; i < search_max_threads; i++){
+        dsp_deque_destroy(thread_work_deque[i]);
+        free(thread_private_work[i].stack.buf);
+    }
+    free(thread_work_deque);
+    free(thread_private_work);
+    free(thread_thieves);
+    free(thread_stats);
+    for(i = 0; i < search_max_threads; i++){
+        free(thread_hits[i].ids);
+    }
+    free(thread_hits);
+    for(i = 0; i < 2; i++){
+        for(j = 0; j < search_max_threads; j++){
+            free(bfs_frontier[i][j].nodes);
+        }
+        free(bfs_frontier[i]);
+    }
+    free(bfs_offsets);
+    dsp_mq_destroy(best_queue);
+    if(search_numa != NULL){
+        dsp_numa_destroy(search_numa);
+        free(search_numa);
+    }
+}
+
+//Run one parallel search over t with num_threads of the pool's threads,
+//using whatever search_val or query_batch is set. Returns the search time
+//in seconds, and leaves its phases in search_phases.
+double run_parallel_search(dfs_tree *t, int num_threads)
+{
+    int i;
+    void *n, *right;
+    dsp_deque_t *q;
+    dsp_rng_t rng;
+    int threads_ready = 1;
+    int node_val;
+    double wake_start = 0.0, end;
+
+    //Set globals for new search...
+    DFS_NUM_THREADS = num_threads;
+    search_tree = t;
+    atomic_store(&val_found, 0);
+    atomic_store(&hit_node, -1);
+    atomic_store(&idle_threads, 0);
+
+    //Recycle the deques, hit buffers and counters from the last search.
+    //An early exit may have left work behind.
+    for(i = 0; i < num_threads; i++){
+        dsp_deque_reset(thread_work_deque[i]);
+        dsp_stack_destroy_nodes(&thread_private_work[i].stack);
+        atomic_store(&thread_private_work[i].hungry, 0);
+        thread_thieves[i].next = (i + 1) % num_threads;
+        thread_thieves[i].last_victim = -1;
+        thread_hits[i].count = 0;
+    }
+    dfs_stats_reset(thread_stats, num_threads);
+
+
+    //The clock starts before predistribution so query hits found there get
+    //a sensible latency.
+    search_start = dfs_stats_now();
+
+
+    if(DFS_SEARCH_MODE == DFS_MODE_BFS){
+        //The root alone is the first level.
+        for(i = 0; i < num_threads; i++){
+            bfs_frontier[0][i].count = 0;
+            bfs_frontier[1][i].count = 0;
+        }
+        bfs_next = 0;
+        bfs_total = -1;
+        frontier_add(&bfs_frontier[0][0], dfs_tree_head(t));
+
+        prog_debug(1, PROGNAME ": waking %d threads\n", num_threads);
+        pthread_barrier_init(&bfs_barrier, NULL, num_threads);
+        wake_start = dfs_stats_now();
+        dsp_pool_run(search_pool, num_threads, thread_bfs, NULL);
+        pthread_barrier_destroy(&bfs_barrier);
+
+    } else if(DFS_SEARCH_MODE == DFS_MODE_BST){
+        //One lookup is not worth waking anyone for.
+        wake_start = dfs_stats_now();
+        if(query_batch == NULL){
+            thread_bst(0, NULL);
+        } else {
+            prog_debug(1, PROGNAME ": waking %d threads\n", num_threads);
+            dsp_pool_run(search_pool, num_threads, thread_bst, NULL);
+        }
+
+    } else if(DFS_SEARCH_MODE == DFS_MODE_BEST){
+        dsp_rng_seed(&rng, num_threads, 0);
+        dsp_mq_reset(best_queue, DFS_BEST_QUEUES_PER_THREAD * num_threads);
+        n = dfs_tree_head(t);
+        if(!dsp_mq_push(best_queue, best_priority(t, n, 0), n, &rng)){
+            perror(PROGNAME ": error: error allocating priority queue");
+            exit(1);
+        }
+
+        prog_debug(1, PROGNAME ": waking %d threads\n", num_threads);
+        wake_start = dfs_stats_now();
+        dsp_pool_run(search_pool, num_threads, thread_best_first, NULL);
+
+    } else {
+
+    //Spread initial work across other thread work deques
+    n = dfs_tree_head(t);
+    while(n != NULL && threads_ready < num_threads) {
+        //A leaf block can't be split up, so it goes to the first thread.
+        if(dfs_node_isblock(t, n)) break;
+        right = dfs_node_right(t, n);
+        if(right != NULL) {
+            dsp_deque_push(thread_work_deque[threads_ready], right);
+            threads_ready++;
+        }
+        //Heck, we might get lucky and find it in this predistribution step
+        if(dfs_node_value(t, n, &node_val) && check_value(node_val, dfs_node_id(t, n))){
+            thread_debug(1, "main thread: search finished during predistribution step!\n");
+            n = NULL;
+            break;
+        }
+        n = dfs_node_left(t, n);
+    }
+
+    thread_debug(1, "main thread: predistribution step checked %d nodes\n", threads_ready - 1);
+
+    //Put current node (post distribution) on first thread's work deque.
+    q = thread_work_deque[0];
+    if(n != NULL) dsp_deque_push(q, n);
+
+
+    if(!atomic_load(&val_found)){
+        prog_debug(1, PROGNAME ": waking %d threads\n", num_threads);
+
+        //Wake threads and wait for them to finish
+        wake_start = dfs_stats_now();
+        dsp_pool_run(search_pool, num_threads, thread_traverse_tree, NULL);
+    }
+
+    }
+
+    end = dfs_stats_now();
+    dfs_stats_phases(&search_phases, thread_stats, num_threads, search_start, wake_start, end);
+
+    prog_debug(1, PROGNAME ": all threads complete\n");
+
+    return end - search_start;
+}
+
+//Search t for val. Prints a result line with the tree size, threads,
+//search time, whether val was found and the node id where, or in all
+//hits mode the id of every hit and then the number of hits and lowest id.
+int search_tree_for_val(dfs_tree *t, int num_threads, int val)
+{
+    double search_time;
+    long *hits;
+    long i, found, node;
+
+    if(dfs_tree_head(t) == NULL) return -1;
+
+    search_val = val;
+    query_batch = NULL;
+    search_time = run_parallel_search(t, num_threads);
+
+    if(DFS_HIT_MODE == DFS_HITS_ALL){
+        hits = merge_hits(num_threads, &found);
+        for(i = 0; i < found; i++){
+            printf("%ld\n", hits[i]);
+        }
+        node = (found > 0) ? hits[0] : -1;
+        free(hits);
+    } else {
+        node = atomic_load(&hit_node);
+        found = (node >= 0);
+    }
+
+    if(found == 0){
+        prog_debug(1, PROGNAME ": value not found in tree!\n");
+    } else {
+        prog_debug(1, PROGNAME ": value found!\n");
+    }
+
+    //printf("size\t\tthreads\t\ttime\t\tfound\t\tnode\n");
+    printf("%d\t\t%d\t\t%.9f\t\t%ld\t\t%ld\n", DFS_TREE_SIZE, num_threads,
+           search_time, found, node);
+    report_stats(t, num_threads, search_time, found, 0);
+
+    return 0;
+}
+
+//Search for the search value, or the queries of b if there are any,
+//DFS_REPEAT times over.
+void run_searches(dfs_tree *t, int num_threads, dfs_query_batch *b)
+{
+    int i;
+
+    for(i = 0; i < DFS_REPEAT; i++){
+        if(b != NULL){
+            prog_debug(1, PROGNAME ": starting search_tree_for_queries...\n");
+            search_tree_for_queries(t, num_threads, b);
+        } else {
+            prog_debug(1, PROGNAME ": starting search_tree_for_val...\n");
+            search_tree_for_val(t, num_threads, search_val);
+        }
+    }
+}
+
+//Gather the hits of every thread's buffer into one sorted array, which
+//the caller frees.
+long *merge_hits(int num_threads, long *count)
+{
+    long *hits;
+    long n = 0;
+    int i;
+
+    for(i = 0; i < num_threads; i++){
+        n += thread_hits[i].count;
+    }
+    hits = (long *)malloc(sizeof(long) * (n + 1));
+    if(hits == NULL){
+        perror(PROGNAME ": error: error allocating memory");
+        exit(1);
+    }
+    n = 0;
+    for(i = 0; i < num_threads; i++){
+        memcpy(&hits[n], thread_hits[i].ids, sizeof(long) * thread_hits[i].count);
+        n += thread_hits[i].count;
+    }
+    qsort(hits, n, sizeof(long), compare_long);
+    *count = n;
+    return hits;
+}
+
+int compare_long(const void *a, const void *b)
+{
+    long x = *(const long *)a;
+    long y = *(const long *)b;
+
+    return (x > y) - (x < y);
+}
+
+//Answer every query in b with a single traversal of t. Prints one line per
+//query with its value, whether it was found and the time until it was
+//(the whole search time if it wasn't), then a summary line.
+int search_tree_for_queries(dfs_tree *t, int num_threads, dfs_query_batch *b)
+{
+    unsigned long i;
+    long slot;
+    double search_time;
+    double latency;
+
+    if(dfs_tree_head(t) == NULL) return -1;
+
+    for(i = 0; i < dsp_valset_slots(&b->set); i++){
+        atomic_store(&b->found[i], 0);
+        b->hit_time[i] = 0.0;
+    }
+    atomic_store(&b->found_count, 0);
+
+    query_batch = b;
+    search_time = run_parallel_search(t, num_threads);
+    query_batch = NULL;
+
+    //printf("value\t\tfound\t\tlatency\n");
+    for(i = 0; i < b->count; i++){
+        slot = b->slot[i];
+        latency = atomic_load(&b->found[slot]) ? b->hit_time[slot] : search_time;
+        printf("%d\t\t%d\t\t%.9f\n", b->values[i], atomic_load(&b->found[slot]), latency);
+    }
+
+    //printf("size\t\tthreads\t\ttime\t\tfound\t\tqueries\t\tqueries/s\n");
+    printf("%d\t\t%d\t\t%.9f\t\t%ld\t\t%lu\t\t%f\n", DFS_TREE_SIZE, num_threads,
+           search_time, atomic_load(&b->found_count), b->distinct,
+           (search_time > 0.0) ? b->count / search_time : 0.0);
+    report_stats(t, num_threads, search_time, atomic_load(&b->found_count), b->count);
+
+    return 0;
+}
+
+//Print the per thread counters of the last search, if asked for.
+void report_stats(dfs_tree *t, int num_threads, double search_time, long found, long queries)
+{
+    dfs_search_summary sum;
+
+    sum.layout = dfs_layout_name(t);
+    sum.mode = dfs_mode_name();
+    sum.size = DFS_TREE_SIZE;
+    sum.threads = num_threads;
+    sum.time = search_time;
+    sum.found = found;
+    sum.queries = queries;
+    sum.phases = search_phases;
+    if(DFS_STATS_FORMAT == DFS_STATS_TEXT){
+        dfs_stats_print_text(stderr, &sum, thread_stats, num_threads);
+    } else if(DFS_STATS_FORMAT == DFS_STATS_JSON){
+        dfs_stats_print_json(stdout, &sum, thread_stats, num_threads);
+    }
+}
+
+const char *dfs_layout_name(dfs_tree *t)
+{
+    switch(t->layout){
+    case DFS_LAYOUT_COMPACT:
+        return (t->ctree->block_count > 0) ? "compact+blocks" : "compact";
+    case DFS_LAYOUT_IMPLICIT:
+        return "implicit";
+    case DFS_LAYOUT_SORTED:
+        return "sorted";
+    default:
+        return "pointer";
+    }
+}
+
+const char *dfs_mode_name()
+{
+    switch(DFS_SEARCH_MODE){
+    case DFS_MODE_BFS:
+        return "bfs";
+    case DFS_MODE_BEST:
+        return "best";
+    case DFS_MODE_BST:
+        return "bst";
+    default:
+        return "dfs";
+    }
+}
+
+//Build a query batch from the values in vals. The batch keeps a pointer
+//to vals, so it must outlive the batch.
+dfs_query_batch *query_batch_create(int *vals, unsigned long count)
+{
+    dfs_query_batch *b;
+    unsigned long i, slots;
+
+    b = (dfs_query_batch *)malloc(sizeof(dfs_query_batch));
+    if(b == NULL || !dsp_valset_init(&b->set, count)){
+        perror(PROGNAME ": error: error allocating query batch");
+        exit(1);
+    }
+    b->values = vals;
+    b->count = count;
+    b->slot = (long *)malloc(sizeof(long) * count);
+    slots = dsp_valset_slots(&b->set);
+    b->found = (atomic_int *)malloc(sizeof(atomic_int) * slots);
+    b->hit_time = (double *)malloc(sizeof(double) * slots);
+    if(b->slot == NULL || b->found == NULL || b->hit_time == NULL){
+        perror(PROGNAME ": error: error allocating query batch");
+        exit(1);
+    }
+    for(i = 0; i < count; i++){
+        b->slot[i] = dsp_valset_insert(&b->set, vals[i]);
+    }
+    b->distinct = b->set.count;
+    return b;
+}
+
+void query_batch_destroy(dfs_query_batch *b)
+{
+    dsp_valset_destroy(&b->set);
+    free(b->slot);
+    free(b->found);
+    free(b->hit_time);
+    free(b);
+}
+
+//Record a hit on a query value. The first thread to hit each distinct
+//value notes the time, and whoever hits the last one ends the search.
+//Returns 1 when the search is over.
+int check_query_value(int value)
+{
+    long slot;
+    int expected = 0;
+
+    slot = dsp_valset_find(&query_batch->set, value);
+    if(slot < 0) return SEARCH_DONE();
+
+    if(atomic_load_explicit(&query_batch->found[slot], memory_order_relaxed) == 0 &&
+       atomic_compare_exchange_strong(&query_batch->found[slot], &expected, 1)){
+        query_batch->hit_time[slot] = dfs_stats_now() - search_start;
+        if(atomic_fetch_add(&query_batch->found_count, 1) + 1 == (long)query_batch->distinct)
+            cancel_search();
+    }
+    return SEARCH_DONE();
+}
+
+//Check the value of node node_id against the search value, or every
+//query in batch mode. For the main thread, before the workers start.
+//Returns 1 when the search is over.
+int check_value(int value, long node_id)
+{
+    if(query_batch != NULL) return check_query_value(value);
+    if(value == search_val) report_hit(0, node_id);
+    return atomic_load(&val_found);
+}
+
+//Tell every worker to stop.
+void cancel_search()
+{
+    cancel_start = dfs_stats_now();
+    atomic_store_explicit(&val_found, 1, memory_order_release);
+}
+
+//Record a hit on the search value at node_id by thread id. In first hit
+//mode the first thread to get here ends the search with its node; in all
+//hits mode the hit goes in the thread's buffer and the search goes on.
+//Returns 1 if the thread should stop.
+int report_hit(int id, long node_id)
+{
+    long expected = -1;
+
+    if(DFS_HIT_MODE == DFS_HITS_ALL){
+        hit_buffer_add(&thread_hits[id], node_id);
+        return 0;
+    }
+    if(atomic_compare_exchange_strong(&hit_node, &expected, node_id))
+        cancel_search();
+    return 1;
+}
+
+void hit_buffer_add(dfs_hit_buffer *h, long node_id)
+{
+    long *ids;
+
+    if(h->count == h->size){
+        ids = (long *)realloc(h->ids, sizeof(long) * ((h->size > 0) ? h->size * 2 : 64));
+        if(ids == NULL){
+            perror(PROGNAME ": error: error allocating hit buffer");
+            exit(1);
+        }
+        h->ids = ids;
+        h->size = (h->size > 0) ? h->size * 2 : 64;
+    }
+    h->ids[h->count++] = node_id;
+}
+
+void thread_traverse_tree(int id, void *arg)
+{
+    dsp_deque_t *q = thread_work_deque[id];
+    dfs_private_work *w = &thread_private_work[id];
+    dfs_thread_stats *st = &thread_stats[id];
+    void *n;
+    long nodes_processed = 0;
+    double start, t0;
+
+    start = dfs_stats_now();
+
+    thread_debug(1, "thread %d: started...\n", id);
+
+    while(1){
+        //Check to see if we are done
+        if(SEARCH_DONE()) break;
+
+        //Get next node from my private stack, then from my deque, which
+        //only holds what was handed out to thieves and nobody took.
+        if(atomic_load_explicit(&w->hungry, memory_order_relaxed))
+            publish_private_work(id, q);
+        n = dsp_stack_pop(&w->stack);
+        if(n == NULL) n = dsp_deque_pop(q);
+        if(n != NULL) st->pops++;
+
+        //If my deque is empty, steal the oldest node from another deque.
+        if(n == NULL){
+            t0 = dfs_stats_now();
+            n = get_next_available_treenode(id);
+            st->steal_time += dfs_stats_now() - t0;
+        }
+
+        //If nothing to steal right now, go idle until more work shows up
+        //or every thread is idle, in which case the search is over.
+        if(n == NULL){
+            t0 = dfs_stats_now();
+            n = wait_for_work(id);
+            st->idle_time += dfs_stats_now() - t0;
+        }
+        if(n == NULL){
+            break;
+        }
+
+        switch(search_tree->layout){
+        case DFS_LAYOUT_COMPACT:
+            nodes_processed += traverse_ctreenodes(id, q, search_tree->ctree,
+                                   (ctreenode *)n);
+            break;
+        case DFS_LAYOUT_IMPLICIT:
+            nodes_processed += traverse_itreenodes(id, q, search_tree->itree->values,
+                                   search_tree->itree->node_count, (int *)n);
+            break;
+        default:
+            nodes_processed += traverse_treenodes(id, q, (treenode *)n);
+        }
+    }
+
+    st->nodes = nodes_processed;
+    finish_thread_stats(st, start);
+    thread_debug(1, "thread %d: exiting after processing %ld nodes...\n", id, nodes_processed);
+}
+
+//Go depth first in searching from n, going to the left child and setting
+//the right child aside for later. Returns the number of nodes processed.
+int traverse_treenodes(int id, dsp_deque_t *q, treenode *n)
+{
+    int node_val;
+    int nodes_processed = 0;
+    long pushes = 0;
+
+    while(n != NULL){
+
+        nodes_processed++;
+
+        //Make sure we are not done.
+        if(SEARCH_DONE()) break;
+
+        //Because this is hit so often, we don't even compile
+        //unless we absolutely need it.
+        //thread_debug(3, "thread %d: traversing node %d\n", id, n->id);
+
+        //Check value against search value, or all queries in batch mode
+        if(n->data != NULL){
+            node_val = *((int *)n->data);
+            if(query_batch != NULL){
+                if(check_query_value(node_val)) break;
+            } else if(node_val == search_val){
+                thread_debug(1, "thread %d: value %d found at node %d!\n",
+                             id, node_val, n->id);
+                if(report_hit(id, n->id)) break;
+            }
+        }
+
+        if(n->right != NULL){
+            set_aside_node(id, q, n->right);
+            pushes++;
+        }
+        n = n->left;
+    }
+    thread_stats[id].pushes += pushes;
+    return nodes_processed;
+}
+
+//Same as traverse_treenodes, over the compact layout. A leaf block ends
+//the descent: its values are scanned in one go.
+int traverse_ctreenodes(int id, dsp_deque_t *q, ctree *t, ctreenode *n)
+{
+    ctreenode *base = t->nodes;
+    int nodes_processed = 0;
+    long pushes = 0;
+
+    while(1){
+
+        nodes_processed++;
+
+        //Make sure we are not done.
+        if(SEARCH_DONE()) break;
+
+        if(ctreenode_isblock(n)){
+            nodes_processed += scan_ctreeblock(id, t, &t->blocks[n->right]) - 1;
+            break;
+        }
+
+        //Check value against search value, or all queries in batch mode
+        if(query_batch != NULL){
+            if(check_query_value(n->value)) break;
+        } else if(n->value == search_val){
+            thread_debug(1, "thread %d: value %d found at node %ld!\n",
+                         id, n->value, (long)(n - base));
+            if(report_hit(id, n - base)) break;
+        }
+
+        if(n->right != CTREE_NIL){
+            set_aside_node(id, q, &base[n->right]);
+            pushes++;
+        }
+        if(n->left == CTREE_NIL) break;
+        n = &base[n->left];
+    }
+    thread_stats[id].pushes += pushes;
+    return nodes_processed;
+}
+
+//Check every value of a leaf block. Returns the number of values in it.
+int scan_ctreeblock(int id, ctree *t, ctreeblock *blk)
+{
+    return scan_values(id, &t->block_values[blk->offset], blk->length,
+                       &t->block_ids[blk->offset], 0);
+}
+
+//Check len values at once. The node id of vals[i] is ids[i], or if ids is
+//NULL, first_id + i. Returns len.
+int scan_values(int id, int *vals, long len, uint32_t *ids, long first_id)
+{
+    long i, k, node;
+
+    if(query_batch != NULL){
+        for(i = 0; i < len; i++){
+            if(check_query_value(vals[i])) break;
+        }
+    } else {
+        //Pick up the scan after each hit, in case all hits are wanted.
+        for(i = 0; i < len; i++){
+            k = dsp_scan_eq(&vals[i], len - i, search_val);
+            if(k < 0) break;
+            i += k;
+            node = (ids != NULL) ? (long)ids[i] : first_id + i;
+            thread_debug(1, "thread %d: value %d found at node %ld!\n",
+                         id, vals[i], node);
+            if(report_hit(id, node)) break;
+        }
+    }
+    return len;
+}
+
+//Same as traverse_treenodes, over the implicit layout. Work items are
+//pointers into the values array, whose offset is the BFS index.
+int traverse_itreenodes(int id, dsp_deque_t *q, int *base, unsigned long count, int *n)
+{
+    unsigned long i = n - base;
+    int nodes_processed = 0;
+    long pushes = 0;
+
+    while(1){
+
+        nodes_processed++;
+
+        //Make sure we are not done.
+        if(SEARCH_DONE()) break;
+
+        //Check value against search value, or all queries in batch mode
+        if(query_batch != NULL){
+            if(check_query_value(base[i])) break;
+        } else if(base[i] == search_val){
+            thread_debug(1, "thread %d: value %d found at node %lu!\n",
+                         id, base[i], i);
+            if(report_hit(id, i)) break;
+        }
+
+        if(ITREE_RIGHT(i) < count){
+            set_aside_node(id, q, &base[ITREE_RIGHT(i)]);
+            pushes++;
+        }
+        if(ITREE_LEFT(i) >= count) break;
+        i = ITREE_LEFT(i);
+    }
+    thread_stats[id].pushes += pushes;
+    return nodes_processed;
+}
+
+//Worker for the level synchronous BFS. Threads meet at a barrier after
+//each level, where one of them sets up the next.
+void thread_bfs(int id, void *arg)
+{
+    dfs_thread_stats *st = &thread_stats[id];
+    double start, t0;
 
-            //Because this is hit so often, we don't even compile
-            //unless we absolutely need it.
-            //thread_debug(3, "thread %d: traversing node %d\n", id, n->id);
+    start = dfs_stats_now();
+    while(1){
+        t0 = dfs_stats_now();
+        if(pthread_barrier_wait(&bfs_barrier) == PTHREAD_BARRIER_SERIAL_THREAD)
+            bfs_next_level();
+        pthread_barrier_wait(&bfs_barrier);
+        st->idle_time += dfs_stats_now() - t0;
+
+        if(bfs_done) break;
+        bfs_visit_level(id);
+    }
+    finish_thread_stats(st, start);
+}
 
-            //Check value against search value
-            if(n->data != NULL){
-                node_val = *((int *)n->data);
-                if(node_val == search_val){
-                    val_found = 1;
-                    thread_debug(1, "thread %d: value %d found at node %d!\n",
-                                 id, node_val, n->id);
-                    break;
-                }
-            }
+//Make the frontiers just filled the current level, or for the implicit
+//layout, move on to the next index range. Run by one thread, between
+//barriers.
+void bfs_next_level()
+{
+    dfs_frontier *cur;
+    unsigned long count;
+    int i;
+
+    if(search_tree->layout == DFS_LAYOUT_IMPLICIT){
+        count = search_tree->itree->node_count;
+        if(bfs_total < 0){
+            bfs_level_start = 0;
+            bfs_total = 1;
+        } else {
+            bfs_level_start += bfs_total;
+            bfs_total *= 2;
+        }
+        if(bfs_level_start >= count)
+            bfs_total = 0;
+        else if(bfs_level_start + bfs_total > count)
+            bfs_total = count - bfs_level_start;
+    } else {
+        cur = bfs_frontier[bfs_next];
+        bfs_next ^= 1;
+        bfs_offsets[0] = 0;
+        for(i = 0; i < DFS_NUM_THREADS; i++){
+            bfs_offsets[i + 1] = bfs_offsets[i] + cur[i].count;
+            bfs_frontier[bfs_next][i].count = 0;
+        }
+        bfs_total = bfs_offsets[DFS_NUM_THREADS];
+    }
+    atomic_store(&bfs_cursor, 0);
+    bfs_done = (SEARCH_DONE() || bfs_total <= 0);
+}
+
+//Take chunks of the current level until it runs out. The children of the
+//nodes visited go on this thread's frontier for the next level.
+void bfs_visit_level(int id)
+{
+    dfs_frontier *cur = bfs_frontier[bfs_next ^ 1];
+    dfs_frontier *next = &bfs_frontier[bfs_next][id];
+    long start, end, i, first;
+    int k;
+
+    while(!SEARCH_DONE()){
+        start = atomic_fetch_add(&bfs_cursor, DFS_BFS_CHUNK);
+        if(start >= bfs_total) break;
+        end = (start + DFS_BFS_CHUNK < bfs_total) ? start + DFS_BFS_CHUNK : bfs_total;
+
+        //A level of the implicit layout is a run of the values array.
+        if(search_tree->layout == DFS_LAYOUT_IMPLICIT){
+            first = bfs_level_start + start;
+            thread_stats[id].nodes += scan_values(id, &search_tree->itree->values[first],
+                                                  end - start, NULL, first);
+            continue;
+        }
+
+        //Find whose frontier the chunk starts in.
+        for(k = 0; bfs_offsets[k + 1] <= start; k++);
+        for(i = start; i < end; i++){
+            while(bfs_offsets[k + 1] <= i) k++;
+            if(bfs_visit_node(id, next, cur[k].nodes[i - bfs_offsets[k]])) return;
+        }
+    }
+}
+
+//Check one node and put its children on next. Returns 1 if the thread
+//should stop.
+int bfs_visit_node(int id, dfs_frontier *next, void *n)
+{
+    dfs_tree *t = search_tree;
+    void *child;
+    int val;
+
+    if(dfs_node_isblock(t, n)){
+        thread_stats[id].nodes += scan_ctreeblock(id, t->ctree,
+                                      &t->ctree->blocks[((ctreenode *)n)->right]);
+        return SEARCH_DONE();
+    }
+
+    thread_stats[id].nodes++;
+    if(dfs_node_value(t, n, &val)){
+        if(query_batch != NULL){
+            if(check_query_value(val)) return 1;
+        } else if(val == search_val){
+            if(report_hit(id, dfs_node_id(t, n))) return 1;
+        }
+    }
+
+    if((child = dfs_node_left(t, n)) != NULL){
+        frontier_add(next, child);
+        thread_stats[id].pushes++;
+    }
+    if((child = dfs_node_right(t, n)) != NULL){
+        frontier_add(next, child);
+        thread_stats[id].pushes++;
+    }
+    return 0;
+}
+
+void frontier_add(dfs_frontier *f, void *n)
+{
+    void **nodes;
+
+    if(f->count == f->size){
+        nodes = (void **)realloc(f->nodes, sizeof(void *) * ((f->size > 0) ? f->size * 2 : 1024));
+        if(nodes == NULL){
+            perror(PROGNAME ": error: error allocating frontier");
+            exit(1);
+        }
+        f->nodes = nodes;
+        f->size = (f->size > 0) ? f->size * 2 : 1024;
+    }
+    f->nodes[f->count++] = n;
+}
+
+//Worker for best first search. Every thread pops the (roughly) best node
+//from the shared priority queue, checks it and pushes its children.
+void thread_best_first(int id, void *arg)
+{
+    dfs_thread_stats *st = &thread_stats[id];
+    dfs_tree *t = search_tree;
+    dsp_rng_t rng;
+    uint64_t key;
+    void *n, *child;
+    int val;
+    double start, t0;
+
+    start = dfs_stats_now();
+    dsp_rng_seed(&rng, id, 0);
+    while(!SEARCH_DONE()){
+        if(!dsp_mq_pop(best_queue, &key, &n, &rng)){
+            t0 = dfs_stats_now();
+            n = best_wait_for_work(id, &rng, &key);
+            st->idle_time += dfs_stats_now() - t0;
+            if(n == NULL) break;
+        }
+        st->pops++;
 
-            if(n->right != NULL){
-                pthread_mutex_lock(dsp_stack_mutex);
-                    dsp_stack_push(s, n->right);
-                pthread_mutex_unlock(dsp_stack_mutex);
+        if(dfs_node_isblock(t, n)){
+            st->nodes += scan_ctreeblock(id, t->ctree, &t->ctree->blocks[((ctreenode *)n)->right]);
+            continue;
+        }
+
+        st->nodes++;
+        if(dfs_node_value(t, n, &val)){
+            if(query_batch != NULL){
+                if(check_query_value(val)) break;
+            } else if(val == search_val){
+                if(report_hit(id, dfs_node_id(t, n))) break;
             }
-            n = n->left;
         }
+
+        if((child = dfs_node_left(t, n)) != NULL)
+            best_push(id, &rng, best_priority(t, child, key), child);
+        if((child = dfs_node_right(t, n)) != NULL)
+            best_push(id, &rng, best_priority(t, child, key), child);
+    }
+    finish_thread_stats(st, start);
+}
+
+//Priority of n in best first search, smaller first: how far its value is
+//from the search value. A batch search has no one value to aim for, so
+//there it is n's depth. A leaf block has no value of its own and goes
+//first.
+uint64_t best_priority(dfs_tree *t, void *n, uint64_t parent_key)
+{
+    int val;
+
+    if(query_batch != NULL) return parent_key + 1;
+    if(!dfs_node_value(t, n, &val)) return 0;
+    return (val > search_val) ? (uint64_t)((long)val - search_val) :
+                                (uint64_t)((long)search_val - val);
+}
+
+void best_push(int id, dsp_rng_t *rng, uint64_t key, void *n)
+{
+    if(!dsp_mq_push(best_queue, key, n, rng)){
+        perror(PROGNAME ": error: error allocating priority queue");
+        exit(1);
+    }
+    thread_stats[id].pushes++;
+}
+
+//Same as wait_for_work, for best first search.
+void *best_wait_for_work(int my_id, dsp_rng_t *rng, uint64_t *key)
+{
+    void *n;
+    int yields = 0;
+    struct timespec sleep_time = {0, 0};
+
+    atomic_fetch_add(&idle_threads, 1);
+    while(!SEARCH_DONE() && atomic_load(&idle_threads) < DFS_NUM_THREADS){
+        if(!dsp_mq_isempty(best_queue)){
+            atomic_fetch_sub(&idle_threads, 1);
+            if(dsp_mq_pop(best_queue, key, &n, rng)) return n;
+            atomic_fetch_add(&idle_threads, 1);
+            yields = 0;
+            sleep_time.tv_nsec = 0;
+            continue;
+        }
+        idle_backoff(&yields, &sleep_time);
+    }
+
+    thread_debug(2, "thread %d: no work left, done waiting\n", my_id);
+    return NULL;
+}
+
+//Lookups in the sorted index. Thread id takes its share of the query
+//batch, or if there is none, finds the search value: its first match and,
+//in all hits mode, the matches after it, which hold the same key.
+void thread_bst(int id, void *arg)
+{
+    dfs_thread_stats *st = &thread_stats[id];
+    etree *t = search_tree->etree;
+    unsigned long i, lo, hi, k;
+    int depth = etree_depth(t);
+    int *vals;
+    double start;
+
+    start = dfs_stats_now();
+    if(query_batch != NULL){
+        vals = query_batch->values;
+        lo = query_batch->count * id / DFS_NUM_THREADS;
+        hi = query_batch->count * (id + 1) / DFS_NUM_THREADS;
+        for(i = lo; i < hi && !SEARCH_DONE(); i++){
+            k = etree_lower_bound(t, vals[i]);
+            st->nodes += depth;
+            if(k != 0 && t->keys[k] == vals[i]) check_query_value(vals[i]);
+        }
+    } else {
+        k = etree_lower_bound(t, search_val);
+        st->nodes += depth;
+        while(k != 0 && t->keys[k] == search_val){
+            if(report_hit(id, t->ids[k])) break;
+            k = etree_next(t, k);
+            st->nodes++;
+        }
+    }
+    finish_thread_stats(st, start);
+}
+
+//Print the count, sum, min and max of the tree's values, then a histogram
+//of them from min to max in DFS_REDUCE_BINS bins, one "bin start count"
+//line each.
+void run_reductions(dfs_tree *t, int num_threads)
+{
+    tree_summary sum;
+    tree_histogram hist;
+    tree_reducer r;
+    long *counts = NULL;
+    double start = dfs_stats_now();
+    int i, ok;
+
+    ok = tree_reduce(t->ptree, search_pool, num_threads, &tree_summary_reducer, &sum);
+    if(ok && DFS_REDUCE_BINS > 0 && sum.count > 0){
+        hist.lo = sum.min;
+        hist.hi = sum.max;
+        hist.bins = DFS_REDUCE_BINS;
+        tree_histogram_reducer(&r, &hist);
+        counts = (long *)malloc(r.size);
+        ok = (counts != NULL && tree_reduce(t->ptree, search_pool, num_threads, &r, counts));
+    }
+    if(!ok){
+        perror(PROGNAME ": error: error allocating reduction");
+        exit(1);
+    }
+    fprintf(stderr, PROGNAME ": reduced tree with %d threads in %.9f seconds\n",
+            num_threads, dfs_stats_now() - start);
+
+    printf("count %ld sum %lld min %d max %d\n", sum.count, sum.sum, sum.min, sum.max);
+    for(i = 0; counts != NULL && i < DFS_REDUCE_BINS; i++){
+        printf("bin %lld %ld\n", tree_histogram_start(&hist, i), counts[i]);
+    }
+    free(counts);
+}
+
+//Record when a worker stopped, and how long after the search was
+//cancelled if it was.
+void finish_thread_stats(dfs_thread_stats *st, double start)
+{
+    st->start_stamp = start;
+    st->stop_stamp = dfs_stats_now();
+    st->run_time = st->stop_stamp - start;
+    if(atomic_load_explicit(&val_found, memory_order_acquire))
+        st->cancel_time = dfs_stats_now() - cancel_start;
+}
+
+//Set a right child aside. Lazily it goes on the private stack, where
+//pushing and popping need no atomics, and only when a thief is hungry
+//is some of the stack moved to the deque.
+void set_aside_node(int id, dsp_deque_t *q, void *n)
+{
+    dfs_private_work *w = &thread_private_work[id];
+
+    if(DFS_PUBLISH_MODE == DFS_PUBLISH_EAGER){
+        dsp_deque_push(q, n);
+        return;
+    }
+    if(!dsp_stack_push(&w->stack, n)){
+        perror(PROGNAME ": error: error growing private work stack");
+        exit(1);
+    }
+    if(atomic_load_explicit(&w->hungry, memory_order_relaxed))
+        publish_private_work(id, q);
+}
+
+//Move the oldest half of my private stack, the nodes nearest the root,
+//to my deque for thieves. With one node or none there is nothing worth
+//giving away yet, so the request is left standing.
+void publish_private_work(int id, dsp_deque_t *q)
+{
+    dfs_private_work *w = &thread_private_work[id];
+    long i, count = dsp_stack_size(&w->stack) / 2;
+
+    if(count == 0) return;
+    atomic_store_explicit(&w->hungry, 0, memory_order_relaxed);
+    for(i = 0; i < count; i++){
+        dsp_deque_push(q, dsp_stack_del_first(&w->stack));
     }
+    thread_stats[id].publishes++;
+    thread_stats[id].nodes_published += count;
+    thread_debug(2, "thread %d: published %ld nodes\n", id, count);
+}
+
+//Ask thread victim to publish work. The flag is read first so that idle
+//thieves don't keep taking its cache line away from the owner.
+void ask_for_work(int victim)
+{
+    atomic_int *hungry = &thread_private_work[victim].hungry;
 
-    thread_debug(1, "thread %d: exiting after processing %d nodes...\n", id, nodes_processed);
-    pthread_exit(0);
+    if(DFS_PUBLISH_MODE == DFS_PUBLISH_LAZY &&
+       !atomic_load_explicit(hungry, memory_order_relaxed))
+        atomic_store_explicit(hungry, 1, memory_order_relaxed);
 }
 
-treenode *get_next_available_treenode(int my_id)
+//Steal work from another thread's deque. With the hier policy, threads
+//on the same node are tried before any across the interconnect.
+void *get_next_available_treenode(int my_id)
 {
-    int r, i, j;
-    dsp_stack_t *s;
-    treenode *n = NULL;
+    void *n;
+
+    if(DFS_STEAL_POLICY != DFS_STEAL_HIER)
+        return steal_from_victims(my_id, DFS_VICTIMS_ALL);
+
+    n = steal_from_victims(my_id, DFS_VICTIMS_LOCAL);
+    if(n == NULL) n = steal_from_victims(my_id, DFS_VICTIMS_REMOTE);
+    return n;
+}
 
-    //Search starting from random index for a thread with available work
-    r = randint(DFS_NUM_THREADS);
+void *steal_from_victims(int my_id, dfs_victims which)
+{
+    int r, i, j, remote;
+    long stolen;
+    dsp_deque_t *q = thread_work_deque[my_id];
+    void *n = NULL;
+
+    //Search starting from the policy's first choice for a thread with
+    //available work
+    r = first_victim(my_id);
     for(i = 0; i < DFS_NUM_THREADS && n == NULL; i++) {
 
         //Allows us to wrap around.
         j = (i+r)%DFS_NUM_THREADS;
+        if(j == my_id) continue;
 
-        //Check thread's stack for work
-        s = thread_work_stack[j];
-        pthread_mutex_lock(&thread_work_stack_mutex[j]);
-            if(!dsp_stack_isempty(s)){
-                n = dsp_stack_del_first(s);
-                thread_debug(2, "thread %d: found work in thread %d's stack!\n",
-                                my_id, j);
-            }
-        pthread_mutex_unlock(&thread_work_stack_mutex[j]);
+        remote = (search_numa != NULL &&
+                  dsp_numa_thread_node(search_numa, j) != dsp_numa_thread_node(search_numa, my_id));
+        if((which == DFS_VICTIMS_LOCAL && remote) ||
+           (which == DFS_VICTIMS_REMOTE && !remote))
+            continue;
 
+        //Move a batch of the oldest nodes from thread's deque onto mine,
+        //so we don't have to come back to steal again right away.
+        stolen = dsp_deque_steal_batch(thread_work_deque[j], q, DFS_STEAL_CHUNK);
+        thread_stats[my_id].steal_attempts++;
+        if(stolen == 0){
+            ask_for_work(j);
+            continue;
+        }
+
+        thread_thieves[my_id].last_victim = j;
+        thread_stats[my_id].steals++;
+        thread_stats[my_id].nodes_stolen += stolen;
+        if(remote) thread_stats[my_id].remote_steals++;
+        thread_debug(2, "thread %d: stole %ld nodes from thread %d's deque!\n",
+                        my_id, stolen, j);
+
+        //Someone may steal them back before we get to them.
+        n = dsp_deque_pop(q);
+        if(n != NULL) thread_stats[my_id].pops++;
     }
 
     return n;
 }
-    
+
+//Where a steal attempt starts looking, by DFS_STEAL_POLICY. No thread
+//shares a generator, so unlike rand() there is no lock to fight over.
+int first_victim(int my_id)
+{
+    dfs_thief *th = &thread_thieves[my_id];
+    int r;
+
+    switch(DFS_STEAL_POLICY){
+    case DFS_STEAL_ROUND_ROBIN:
+        r = th->next;
+        th->next = (r + 1) % DFS_NUM_THREADS;
+        return r;
+    case DFS_STEAL_LAST:
+        if(th->last_victim >= 0) return th->last_victim;
+        break;
+    default:
+        break;
+    }
+    return dsp_rng_below(&th->rng, DFS_NUM_THREADS);
+}
+
+
+//Idle loop for a thread with no work. A thread counts itself idle only while
+//its private stack and deque are empty and it holds no node, so once all
+//DFS_NUM_THREADS are idle there is no work left anywhere and nobody can
+//make more. A thread
+//leaves the idle count before it tries to steal, so it is never counted
+//idle while holding stolen work. Busy threads keep their work private
+//until asked, so while nothing is stealable every one of them is asked
+//for some. Returns NULL when the search is over.
+void *wait_for_work(int my_id)
+{
+    void *n;
+    int i, yields = 0;
+    struct timespec sleep_time = {0, 0};
+
+    atomic_fetch_add(&idle_threads, 1);
+    while(!SEARCH_DONE() && atomic_load(&idle_threads) < DFS_NUM_THREADS){
+
+        //Only look at deque sizes here, stealing is for when there is
+        //something to take.
+        if(work_available(my_id)){
+            atomic_fetch_sub(&idle_threads, 1);
+            n = get_next_available_treenode(my_id);
+            if(n != NULL) return n;
+            atomic_fetch_add(&idle_threads, 1);
+            yields = 0;
+            sleep_time.tv_nsec = 0;
+            continue;
+        }
+
+        for(i = 0; i < DFS_NUM_THREADS; i++){
+            if(i != my_id) ask_for_work(i);
+        }
+        idle_backoff(&yields, &sleep_time);
+    }
+
+    thread_debug(2, "thread %d: no work left, done waiting\n", my_id);
+    return NULL;
+}
+
+//Back off once more: a few yields first, then ever longer sleeps.
+void idle_backoff(int *yields, struct timespec *sleep_time)
+{
+    if(*yields < DFS_IDLE_YIELDS){
+        (*yields)++;
+        sched_yield();
+    } else {
+        if(sleep_time->tv_nsec == 0)
+            sleep_time->tv_nsec = DFS_IDLE_SLEEP_MIN_NS;
+        else if(sleep_time->tv_nsec < DFS_IDLE_SLEEP_MAX_NS)
+            sleep_time->tv_nsec *= 2;
+        nanosleep(sleep_time, NULL);
+    }
+}
+
+//Returns 1 if some other thread's deque looks nonempty.
+int work_available(int my_id)
+{
+    int i;
+
+    for(i = 0; i < DFS_NUM_THREADS; i++){
+        if(i != my_id && !dsp_deque_isempty(thread_work_deque[i]))
+            return 1;
+    }
+    return 0;
+}
 
 int randint(int max)
 {
@@ -611,6 +2829,38 @@ void printNode(treenode *n, void *arg)
     fprintf(f, "\n");
 }
 
+void printCNode(ctree *t, uint32_t i, void *arg)
+{
+    FILE *f = (FILE *)arg;
+    ctreenode *n = &t->nodes[i];
+    ctreeblock *blk;
+    uint32_t left = ctree_left(t, i), right = ctree_right(t, i);
+
+    fprintf(f, "node %u [%d]:", i, n->value);
+    //A block root's own links hold the block, not its children.
+    if(ctreenode_isblock(n)){
+        blk = &t->blocks[n->right];
+        fprintf(f, " block:%u offset:%u length:%u", n->right, blk->offset, blk->length);
+    }
+    if(left != CTREE_NIL)
+        fprintf(f, " left:%u [%d]", left, t->nodes[left].value);
+    if(right != CTREE_NIL)
+        fprintf(f, " right:%u [%d]", right, t->nodes[right].value);
+    fprintf(f, "\n");
+}
+
+void printINode(itree *t, unsigned long i, void *arg)
+{
+    FILE *f = (FILE *)arg;
+
+    fprintf(f, "node %lu [%d]:", i, t->values[i]);
+    if(ITREE_LEFT(i) < t->node_count)
+        fprintf(f, " left:%lu [%d]", ITREE_LEFT(i), t->values[ITREE_LEFT(i)]);
+    if(ITREE_RIGHT(i) < t->node_count)
+        fprintf(f, " right:%lu [%d]", ITREE_RIGHT(i), t->values[ITREE_RIGHT(i)]);
+    fprintf(f, "\n");
+}
+
 void findVal(treenode *n, void *arg)
 {
     int node_val;
@@ -652,3 +2902,465 @@ void prog_debug(int level, const char* message, ...)
         va_end(printf_args);
     }
 }
+
+
+#ifdef DFS_MPI
+
+//------------- MPI Search -------------------
+
+void printMpiUsage()
+{
+    printf("\tmpiexec -n ranks " PROGNAME " [-h | -u units | -v] [filename] [searchvalue]\n"
+           "\t\t[threads per rank]\n");
+}
+
+void printMpiHelp()
+{
+    printMpiUsage();
+    printf("\n\t" PROGNAME " searches the balanced tree over the values in\n"
+           "\tfilename (dfs-search -b -L bfs) with several processes. The\n"
+           "\ttree is cut into subtrees, which are dealt out to the ranks;\n"
+           "\teach rank searches its subtrees one at a time with the\n"
+           "\tthreaded depth first search, and an idle rank steals\n"
+           "\tsubtrees from a random other rank. The first hit stops every\n"
+           "\trank. Give a binary .i32 file: each rank maps it, and only\n"
+           "\treads in the pages of the subtrees it searches.\n"
+           "\tRank 0 prints the usual result line, with the threads of\n"
+           "\tall ranks as the thread count.\n");
+    printf("\tOptions:\n"
+           "\t\t-h : show this help\n"
+           "\t\t-u : subtrees to deal to each rank (default %d)\n"
+           "\t\t-v : print each rank's thread creation time, and what\n"
+           "\t\t     it searched and stole, on stderr\n\n",
+           DFS_MPI_UNITS_PER_RANK);
+}
+
+int mpi_main(int argc, char **argv)
+{
+    int c, provided, num_threads;
+    int units_per_rank = DFS_MPI_UNITS_PER_RANK;
+    int verbose = 0;
+    intfile_t input;
+    dfs_tree t;
+    dfs_mpi_rank mr;
+    pthread_t runner;
+    unsigned long level;
+    long i, first_unit, total_units, node, separator_hit = -1;
+    double start, search_time;
+
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+    if(provided < MPI_THREAD_FUNNELED){
+        fprintf(stderr, PROGNAME ": error: MPI library can't be used with threads\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    memset(&mr, 0, sizeof(mr));
+    MPI_Comm_rank(MPI_COMM_WORLD, &mr.rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &mr.num_ranks);
+
+    //Every rank sees the same arguments, so all of them quit together.
+    while((c = getopt(argc, argv, "+hu:v")) != -1){
+        switch(c){
+        case 'h':
+            if(mr.rank == 0){
+                printf("\n");
+                printMpiHelp();
+            }
+            MPI_Finalize();
+            exit(0);
+        case 'u':
+            units_per_rank = atoi(optarg);
+            if(units_per_rank < 1){
+                if(mr.rank == 0){
+                    printf(PROGNAME ": error: subtrees per rank must be at least 1\n");
+                    printMpiUsage();
+                }
+                MPI_Finalize();
+                exit(1);
+            }
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        default:
+            if(mr.rank == 0) printMpiUsage();
+            MPI_Finalize();
+            exit(1);
+        }
+    }
+    if(argc - optind != 3){
+        if(mr.rank == 0){
+            printArgError();
+            printMpiUsage();
+        }
+        MPI_Finalize();
+        exit(1);
+    }
+    search_val = atoi(argv[optind+1]);
+    num_threads = atoi(argv[optind+2]);
+    if(num_threads < 1 || num_threads > DFS_THREAD_MAX){
+        if(mr.rank == 0){
+            printf(PROGNAME ": error: threads per rank must be 1 to %d\n", DFS_THREAD_MAX);
+            printMpiUsage();
+        }
+        MPI_Finalize();
+        exit(1);
+    }
+
+    if(intfile_load(&input, argv[optind], num_threads) != 0){
+        perror(PROGNAME ": error: problem reading file");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    if(input.count == 0 || input.count > INT_MAX){
+        fprintf(stderr, PROGNAME ": error: %lu values to process!\n", input.count);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    DFS_TREE_SIZE = input.count;
+
+    //The input is the tree, in BFS order, so a subtree is just the index
+    //of its root.
+    t.layout = DFS_LAYOUT_IMPLICIT;
+    t.ptree = NULL;
+    t.ctree = NULL;
+    t.etree = NULL;
+    t.itree = makeBfsITreeFromArray(input.data, DFS_TREE_SIZE);
+    t.root = 0;
+
+    //Cut the tree at the first level with units_per_rank subtrees per
+    //rank, or at the bottom level if the tree is too small for that. Rank
+    //r starts with the r-th run of the level's subtrees, and rank 0 checks
+    //the nodes above the cut itself.
+    level = 1;
+    while(level < (unsigned long)units_per_rank * mr.num_ranks && 2 * level - 1 < input.count)
+        level *= 2;
+    first_unit = level - 1;
+    total_units = ((2 * level - 1 < input.count) ? (long)(2 * level - 1) : (long)input.count)
+                  - first_unit;
+
+    mr.num_threads = num_threads;
+    mr.tree = &t;
+    mr.hit = -1;
+    mr.size = total_units;
+    mr.units = (long *)malloc(sizeof(long) * total_units);
+    if(mr.units == NULL){
+        perror(PROGNAME ": error: error allocating memory");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    for(i = total_units * mr.rank / mr.num_ranks;
+        i < total_units * (mr.rank + 1) / mr.num_ranks; i++){
+        mr.units[mr.last++] = first_unit + i;
+    }
+    pthread_mutex_init(&mr.lock, NULL);
+    pthread_cond_init(&mr.cond, NULL);
+
+    if(mr.rank == 0){
+        fprintf(stderr, PROGNAME ": %d ranks of %d threads, %ld subtrees of %lu values\n",
+                mr.num_ranks, num_threads, total_units, input.count);
+    }
+
+    //One line per rank would only be noise.
+    search_setup_report = verbose;
+    search_setup(num_threads);
+    query_batch = NULL;
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    start = dfs_stats_now();
+    //The nodes above the cut are part of the search, so are timed with it.
+    if(mr.rank == 0){
+        for(i = 0; i < first_unit && separator_hit < 0; i++){
+            if(input.data[i] == search_val) separator_hit = i;
+        }
+    }
+    if(pthread_create(&runner, NULL, mpi_run_units, &mr) != 0){
+        perror(PROGNAME ": error: problem creating thread");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    node = mpi_search(&mr, total_units, separator_hit);
+    pthread_join(runner, NULL);
+    search_time = dfs_stats_now() - start;
+
+    if(mr.rank == 0){
+        //printf("size\t\tthreads\t\ttime\t\tfound\t\tnode\n");
+        printf("%d\t\t%d\t\t%.9f\t\t%d\t\t%ld\n", DFS_TREE_SIZE,
+               mr.num_ranks * num_threads, search_time, node >= 0, node);
+        fflush(stdout);
+    }
+    if(verbose)
+        fprintf(stderr, PROGNAME ": rank %d searched %ld subtrees, stole %ld in %ld requests\n",
+                mr.rank, mr.searched, mr.stolen, mr.requests);
+
+    search_teardown();
+    pthread_mutex_destroy(&mr.lock);
+    pthread_cond_destroy(&mr.cond);
+    free(mr.units);
+    free(mr.sends);
+    free_dfs_tree(&t);
+    intfile_release(&input);
+    MPI_Finalize();
+    return 0;
+}
+
+//Runner thread of a rank: search subtrees off the rank's list with the
+//threaded search until told to stop, or until one of them has a hit.
+void *mpi_run_units(void *arg)
+{
+    dfs_mpi_rank *mr = (dfs_mpi_rank *)arg;
+    long node;
+
+    pthread_mutex_lock(&mr->lock);
+    while(1){
+        while(!mr->stop && mr->first == mr->last)
+            pthread_cond_wait(&mr->cond, &mr->lock);
+        if(mr->stop) break;
+        mr->tree->root = mr->units[mr->first++];
+        mr->busy = 1;
+        pthread_mutex_unlock(&mr->lock);
+
+        run_parallel_search(mr->tree, mr->num_threads);
+        node = atomic_load(&hit_node);
+
+        pthread_mutex_lock(&mr->lock);
+        mr->busy = 0;
+        mr->finished++;
+        mr->searched++;
+        if(node >= 0){
+            mr->hit = node;
+            mr->found = 1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&mr->lock);
+    return NULL;
+}
+
+//MPI side of a rank, run by the thread that started MPI. Answers steal
+//requests, steals when the runner is out of subtrees, and reports searched
+//subtrees and hits to rank 0, which counts them and tells every rank to
+//stop once all subtrees are searched or one has a hit. Every message is
+//sent synchronously, and a rank only joins the closing barrier once its
+//sends are received and it has no steal request out, so nothing is left
+//in flight at MPI_Finalize. Returns the node id of the hit, or -1.
+long mpi_search(dfs_mpi_rank *mr, long total_units, long separator_hit)
+{
+    MPI_Status status;
+    MPI_Request barrier;
+    long *roots;
+    long done = 0, finished, hit, node = -1, k;
+    int flag, count, idle, busy, progress, victim;
+    int stealing = 0, in_barrier = 0;
+    dsp_rng_t rng;
+    struct timespec poll_time = {0, DFS_MPI_POLL_NS};
+
+    roots = (long *)malloc(sizeof(long) * total_units);
+    if(roots == NULL){
+        perror(PROGNAME ": error: error allocating memory");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    dsp_rng_seed(&rng, mr->rank, 0);
+    if(separator_hit >= 0){
+        node = separator_hit;
+        mpi_stop_all(mr, node);
+    }
+
+    while(1){
+        progress = 0;
+
+        MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, &flag, &status);
+        while(flag){
+            progress = 1;
+            switch(status.MPI_TAG){
+            case DFS_MPI_STEAL:
+                //Give away the newer half of what is waiting.
+                MPI_Recv(NULL, 0, MPI_LONG, status.MPI_SOURCE, DFS_MPI_STEAL,
+                         MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+                pthread_mutex_lock(&mr->lock);
+                k = mr->stop ? 0 : (mr->last - mr->first + 1) / 2;
+                mr->last -= k;
+                pthread_mutex_unlock(&mr->lock);
+                mpi_send(mr, status.MPI_SOURCE, DFS_MPI_WORK, &mr->units[mr->last], k);
+                break;
+            case DFS_MPI_WORK:
+                MPI_Get_count(&status, MPI_LONG, &count);
+                MPI_Recv(roots, count, MPI_LONG, status.MPI_SOURCE, DFS_MPI_WORK,
+                         MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+                stealing = 0;
+                if(count > 0 && !mr->stop){
+                    mpi_add_units(mr, roots, count);
+                    mr->stolen += count;
+                } else {
+                    progress = 0;
+                }
+                break;
+            case DFS_MPI_DONE:
+                MPI_Recv(&k, 1, MPI_LONG, status.MPI_SOURCE, DFS_MPI_DONE,
+                         MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+                done += k;
+                break;
+            case DFS_MPI_FOUND:
+                MPI_Recv(&k, 1, MPI_LONG, status.MPI_SOURCE, DFS_MPI_FOUND,
+                         MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+                if(!mr->stop){
+                    node = k;
+                    mpi_stop_all(mr, node);
+                }
+                break;
+            case DFS_MPI_STOP:
+                MPI_Recv(&node, 1, MPI_LONG, 0, DFS_MPI_STOP,
+                         MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+                mpi_set_stop(mr);
+                break;
+            }
+            MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, &flag, &status);
+        }
+
+        //Pass on what the runner did, the hit first, so rank 0 never counts
+        //the last subtree done before it hears of a hit in it.
+        pthread_mutex_lock(&mr->lock);
+        finished = mr->finished;
+        mr->finished = 0;
+        hit = mr->hit;
+        mr->hit = -1;
+        busy = mr->busy;
+        idle = (!busy && mr->first == mr->last && !mr->found);
+        pthread_mutex_unlock(&mr->lock);
+        if(hit >= 0 && !mr->stop){
+            progress = 1;
+            if(mr->rank == 0){
+                node = hit;
+                mpi_stop_all(mr, node);
+            } else {
+                mpi_send(mr, 0, DFS_MPI_FOUND, &hit, 1);
+            }
+        }
+        if(finished > 0 && !mr->stop){
+            progress = 1;
+            if(mr->rank == 0)
+                done += finished;
+            else
+                mpi_send(mr, 0, DFS_MPI_DONE, &finished, 1);
+        }
+        if(mr->rank == 0 && !mr->stop && done == total_units)
+            mpi_stop_all(mr, -1);
+
+        //Out of work: ask a random other rank for some.
+        if(idle && !mr->stop && !stealing && mr->num_ranks > 1){
+            victim = dsp_rng_below(&rng, mr->num_ranks - 1);
+            if(victim >= mr->rank) victim++;
+            mpi_send(mr, victim, DFS_MPI_STEAL, NULL, 0);
+            stealing = 1;
+            mr->requests++;
+        }
+
+        if(mr->stop){
+            //Starting its last subtree, the runner may have cleared the
+            //cancellation token after it was set.
+            if(busy) atomic_store_explicit(&val_found, 1, memory_order_release);
+            if(!in_barrier && !stealing && mpi_test_sends(mr) == 0){
+                MPI_Ibarrier(MPI_COMM_WORLD, &barrier);
+                in_barrier = 1;
+            }
+            if(in_barrier){
+                MPI_Test(&barrier, &flag, MPI_STATUS_IGNORE);
+                if(flag && mpi_test_sends(mr) == 0) break;
+            }
+        }
+
+        mpi_test_sends(mr);
+        if(!progress) nanosleep(&poll_time, NULL);
+    }
+
+    //Same for a runner still searching.
+    pthread_mutex_lock(&mr->lock);
+    while(mr->busy){
+        pthread_mutex_unlock(&mr->lock);
+        atomic_store_explicit(&val_found, 1, memory_order_release);
+        nanosleep(&poll_time, NULL);
+        pthread_mutex_lock(&mr->lock);
+    }
+    pthread_mutex_unlock(&mr->lock);
+
+    free(roots);
+    return node;
+}
+
+//Add stolen subtree roots to the end of my list, and wake the runner.
+void mpi_add_units(dfs_mpi_rank *mr, long *roots, long count)
+{
+    pthread_mutex_lock(&mr->lock);
+    //A rank never holds more than all the subtrees, so moving what is
+    //waiting to the front always makes room.
+    if(mr->last + count > mr->size){
+        memmove(mr->units, &mr->units[mr->first], sizeof(long) * (mr->last - mr->first));
+        mr->last -= mr->first;
+        mr->first = 0;
+    }
+    memcpy(&mr->units[mr->last], roots, sizeof(long) * count);
+    mr->last += count;
+    pthread_cond_signal(&mr->cond);
+    pthread_mutex_unlock(&mr->lock);
+}
+
+//Start a synchronous send of count longs from vals, copied so the caller
+//can reuse them. mpi_test_sends finishes it.
+void mpi_send(dfs_mpi_rank *mr, int dest, int tag, long *vals, int count)
+{
+    dfs_mpi_send *s;
+
+    if(mr->num_sends == mr->max_sends){
+        mr->max_sends = (mr->max_sends > 0) ? mr->max_sends * 2 : 16;
+        s = (dfs_mpi_send *)realloc(mr->sends, sizeof(dfs_mpi_send) * mr->max_sends);
+        if(s == NULL){
+            perror(PROGNAME ": error: error allocating memory");
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        mr->sends = s;
+    }
+    s = &mr->sends[mr->num_sends];
+    s->buf = (long *)malloc(sizeof(long) * ((count > 0) ? count : 1));
+    if(s->buf == NULL){
+        perror(PROGNAME ": error: error allocating memory");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    if(count > 0) memcpy(s->buf, vals, sizeof(long) * count);
+    MPI_Issend(s->buf, count, MPI_LONG, dest, tag, MPI_COMM_WORLD, &s->req);
+    mr->num_sends++;
+}
+
+//Finish the sends that have been received. Returns how many have not.
+int mpi_test_sends(dfs_mpi_rank *mr)
+{
+    int i = 0, flag;
+
+    while(i < mr->num_sends){
+        MPI_Test(&mr->sends[i].req, &flag, MPI_STATUS_IGNORE);
+        if(!flag){
+            i++;
+            continue;
+        }
+        free(mr->sends[i].buf);
+        mr->sends[i] = mr->sends[--mr->num_sends];
+    }
+    return mr->num_sends;
+}
+
+//Rank 0: end the search everywhere, with node as the hit, or -1.
+void mpi_stop_all(dfs_mpi_rank *mr, long node)
+{
+    int i;
+
+    for(i = 1; i < mr->num_ranks; i++){
+        mpi_send(mr, i, DFS_MPI_STOP, &node, 1);
+    }
+    mpi_set_stop(mr);
+}
+
+//Stop taking subtrees, and cancel the one being searched.
+void mpi_set_stop(dfs_mpi_rank *mr)
+{
+    pthread_mutex_lock(&mr->lock);
+    mr->stop = 1;
+    pthread_cond_broadcast(&mr->cond);
+    pthread_mutex_unlock(&mr->lock);
+    cancel_search();
+}
+
+#endif
@@ -0,0 +1,84 @@
+//Written by David Ells
+//
+//A static search tree in Eytzinger order. See etree.h.
+
+#include <stdlib.h>
+#include "etree.h"
+
+void etree_init(etree *t)
+{
+    t->keys = NULL;
+    t->ids = NULL;
+    t->node_count = 0;
+}
+
+//Allocate room for node_count keys. Returns 0 on failure.
+int etree_alloc(etree *t, unsigned long node_count)
+{
+    if(node_count > UINT32_MAX) return 0;
+
+    t->keys = (int *)malloc(sizeof(int) * (node_count + 1));
+    t->ids = (uint32_t *)malloc(sizeof(uint32_t) * (node_count + 1));
+    if(t->keys == NULL || t->ids == NULL){
+        free(t->keys);
+        free(t->ids);
+        etree_init(t);
+        return 0;
+    }
+    t->node_count = node_count;
+    return 1;
+}
+
+void etree_free(etree *t)
+{
+    free(t->keys);
+    free(t->ids);
+    etree_init(t);
+}
+
+//Number of nodes in the subtree under node k of a tree of n nodes.
+unsigned long etree_subtree_size(unsigned long n, unsigned long k)
+{
+    unsigned long size = 0, lo = k, hi = k;
+
+    while(lo <= n){
+        size += ((hi < n) ? hi : n) - lo + 1;
+        lo = 2 * lo;
+        hi = 2 * hi + 1;
+    }
+    return size;
+}
+
+//The first node in order whose key is not less than key, or 0 if there is
+//none. The descent has no data dependent branches: it always goes to the
+//bottom, then climbs back past the right turns taken since the last left.
+unsigned long etree_lower_bound(etree *t, int key)
+{
+    unsigned long k = 1, n = t->node_count;
+    int *keys = t->keys;
+
+    while(k <= n){
+        //Sixteen keys to a cache line: the line four levels down.
+        __builtin_prefetch(&keys[16 * k]);
+        k = 2 * k + (keys[k] < key);
+    }
+    return k >> __builtin_ffsl(~k);
+}
+
+//The node after k in order, or 0 if k is the last.
+unsigned long etree_next(etree *t, unsigned long k)
+{
+    if(2 * k + 1 <= t->node_count){
+        k = 2 * k + 1;
+        while(2 * k <= t->node_count) k = 2 * k;
+        return k;
+    }
+    while(k & 1) k >>= 1;
+    return k >> 1;
+}
+
+//Levels in the tree, the number of keys a lookup compares.
+int etree_depth(etree *t)
+{
+    return (t->node_count == 0) ? 0 : 64 - __builtin_clzl(t->node_count);
+}
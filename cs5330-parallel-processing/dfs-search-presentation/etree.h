@@ -0,0 +1,32 @@
+//Written by David Ells
+//
+//A static binary search tree over sorted values, in Eytzinger order: the
+//keys of the complete search tree are stored level by level, node k (from
+//1) having children 2k and 2k+1, so there are no links and a lookup only
+//does index arithmetic. The top levels share a few cache lines, and the
+//lookup prefetches the levels below ahead of its compares.
+//
+//Each key carries the id (input position) of the value it came from.
+//Equal keys are ordered by id, so the first match in order is the lowest
+//id.
+
+#ifndef ETREE_H
+#define ETREE_H
+
+#include <stdint.h>
+
+typedef struct {
+    int *keys;              //keys[1..node_count]
+    uint32_t *ids;
+    unsigned long node_count;
+} etree;
+
+void etree_init(etree *);
+int etree_alloc(etree *, unsigned long);
+void etree_free(etree *);
+unsigned long etree_subtree_size(unsigned long, unsigned long);
+unsigned long etree_lower_bound(etree *, int);
+unsigned long etree_next(etree *, unsigned long);
+int etree_depth(etree *);
+
+#endif
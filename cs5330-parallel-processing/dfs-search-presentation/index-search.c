@@ -4,11 +4,17 @@
  * Run with -h flag to see usage and help. */
 
 #include <errno.h>
+#include <getopt.h>
+#include <limits.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/time.h>
+#include <time.h>
+
+#include "intfile.h"
+#include "simd.h"
 
 #define PROGNAME "index-search"
 #define INDEX_THREAD_MAX 128 
@@ -16,23 +22,66 @@
 #define INDEX_DEBUG_TIME 0
 #define INDEX_DEBUG_PROGRESS 0
 
+//Values the vector kernels scan between looks at val_found: 16 KiB, so
+//a block stays in L1 while it is compared.
+#define INDEX_SCAN_BLOCK 4096
+
 typedef struct {
     int id;
     int *array;
     int start;
     int end;
+    double stop;            //when the thread finished
 } index_thread_args;
 
+//A window of the file in streaming mode.
+typedef struct {
+    char *bytes;
+    long len;
+} index_chunk;
+
+//Streaming mode (-s) state. A reader thread reads the file a window at a
+//time into free chunks and queues them as full; search threads take full
+//chunks, scan them and hand them back. Both queues are rings of chunk
+//numbers, under ring_lock.
+typedef struct {
+    index_chunk *chunks;
+    int num_chunks;
+    int *full;
+    int full_head, full_count;
+    int *empty;
+    int empty_head, empty_count;
+    int reader_done;
+    unsigned long values;           //values scanned
+    unsigned long bytes;            //bytes read
+    pthread_mutex_t ring_lock;
+    pthread_cond_t ring_filled;
+    pthread_cond_t ring_emptied;
+} index_stream;
+
 //Global variables
-int search_val, val_found;
+int search_val;
+atomic_int val_found;             //set once any thread finds search_val
 int INDEX_ARRAY_SIZE;
+int INDEX_REPEAT = 1;
+int INDEX_PHASES = 0;
+long INDEX_STREAM_CHUNK = 0;        //bytes per window, 0 to load the whole file
+int INDEX_SCAN_ELEMENT = 0;         //compare an element at a time, as before
 
 pthread_t *threads;
-pthread_mutex_t val_found_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+intfile_stream_t stream_file;
+index_stream search_stream;
 
 //Function prototypes
 int search_array_for_val(int *array, int array_size, int num_threads, int val);
 void *thread_search_array(void *args);
+int stream_search_for_val(const char *fname, int num_threads, int val);
+void *thread_read_stream(void *args);
+void *thread_search_stream(void *args);
+void search(const char *fname, int *array, int array_size, int num_threads);
+long scan_for_val(int *vals, long n);
+double index_now();
 int randint(int);
 
 //Some function declarations
@@ -43,7 +92,7 @@ void printArgError()
 
 void printUsage()
 {
-    printf("\t" PROGNAME " [-h] [filename] [searchvalue] [number of threads]\n");
+    printf("\t" PROGNAME " [-h | -k kernel | -r repeats | -s size | -v] [filename] [searchvalue] [number of threads]\n");
 }
 
 void printHelp()
@@ -53,29 +102,86 @@ void printHelp()
            "\tintegers from the file specified into an internal array. It will\n"
            "\tcreate the number of concurrent threads specified to\n"
            "\tperform a simple sequential search of the array in parallel.\n"
+           "\tThe file may be text, or a binary .i32 file as written by\n"
+           "\trandints --binary, which is mapped instead of parsed.\n"
            "\tNote that just one processor may also be specified.\n");
     printf("\tOptions:\n"
-           "\t\t-h : show this help\n");
+           "\t\t-h : show this help\n"
+           "\t\t-k : how to compare values: avx512, avx2, sse4 or scalar\n"
+           "\t\t     scan blocks of values, checking whether another\n"
+           "\t\t     thread found the value between blocks (the default\n"
+           "\t\t     is the best the processor has); element is the old\n"
+           "\t\t     loop, checking before every value\n"
+           "\t\t-r : run each search this many times, printing a result\n"
+           "\t\t     line each time, for benchmarks (see dfsbench)\n"
+           "\t\t-s : stream the file instead of loading it, for files\n"
+           "\t\t     bigger than memory: a reader thread reads windows of\n"
+           "\t\t     size KiB into a ring the search threads scan, and\n"
+           "\t\t     stops reading once the value is found. The size\n"
+           "\t\t     column is then the number of values scanned\n"
+           "\t\t-v : print the time taken by each phase on stderr: file\n"
+           "\t\t     load, then for each search thread spawn, search and\n"
+           "\t\t     join, then teardown\n");
 }
 
 int main(int argc, char **argv)
 {
-    int i, next_int;
+    int i, c;
     int num_threads;
     int *int_arr;
-    FILE* f;
+    intfile_t input;
+    double t0;
     char *fname;
-    int arr_space = 1024;
+    char *kernel = NULL;
     int keyword_start_index = 1;
 
-    //Check args for -h flag, print help and exit if found.
-    for(i = 1; i < argc; i++){
-        if( strcmp(argv[i], "-h") == 0){
+    //Check args for flags. The leading '+' stops at the first non-option,
+    //so a negative search value is not taken for a flag.
+    while((c = getopt(argc, argv, "+hk:r:s:v")) != -1){
+        switch(c){
+        case 'h':
             printf("\n");
             printHelp(); 
             exit(0);
+        case 'k':
+            if(strcmp(optarg, "element") == 0)
+                INDEX_SCAN_ELEMENT = 1;
+            else
+                kernel = optarg;
+            break;
+        case 'r':
+            INDEX_REPEAT = atoi(optarg);
+            if(INDEX_REPEAT < 1){
+                printf(PROGNAME ": error: repeats must be at least 1\n");
+                printUsage();
+                exit(1);
+            }
+            break;
+        case 's':
+            INDEX_STREAM_CHUNK = atol(optarg) * 1024;
+            if(INDEX_STREAM_CHUNK <= INTFILE_CARRY_MAX){
+                printf(PROGNAME ": error: stream window must be at least 1 KiB\n");
+                printUsage();
+                exit(1);
+            }
+            break;
+        case 'v':
+            INDEX_PHASES = 1;
+            break;
+        default:
+            printUsage();
+            exit(1);
         }
     }
+    keyword_start_index = optind;
+
+    //Pick the scan kernel now, rather than on the first scan, which the
+    //search threads would all make at once.
+    if(!dsp_simd_init(kernel)){
+        printf(PROGNAME ": error: kernel %s is unknown or not supported here\n", kernel);
+        printUsage();
+        exit(1);
+    }
 
     //Debug args
     /*printf("keyword index = %d\n", keyword_start_index);
@@ -105,44 +211,46 @@ int main(int argc, char **argv)
 
 
 
-    //------------- Read in data file ----------------
-
-    //Open file.
-    if((f = fopen(fname, "r")) == NULL){
-        perror(PROGNAME ": error: problem opening file");
-        exit(1);
-    }
+    if(INDEX_PHASES)
+        fprintf(stderr, PROGNAME ": scanning with %s\n",
+                INDEX_SCAN_ELEMENT ? "element" : dsp_simd_name());
 
+    //------------- Read in data file ----------------
 
-    //Allocate array for the values.
-    int_arr = (int*)malloc(sizeof(int) * arr_space);
-    if(int_arr == NULL){
-        perror(PROGNAME ": error: error allocating memory");
-        exit(1);
+    //A streamed file is read by every search instead.
+    if(INDEX_STREAM_CHUNK > 0){
+        if(num_threads == 0){
+            for(num_threads = 1; num_threads <= INDEX_THREAD_MAX; num_threads *= 2){
+                search(fname, NULL, 0, num_threads);
+            }
+        } else {
+            search(fname, NULL, 0, num_threads);
+        }
+        return 0;
     }
 
 #if INDEX_DEBUG_PROGRESS > 0
-    printf(PROGNAME ": scanning in values from %s...\n", fname);
+    printf(PROGNAME ": loading values from %s...\n", fname);
 #endif
-    //Scan to get values, growing array if needed.
-    fseek(f, 0, SEEK_SET);
-    for(i = 0; (fscanf(f,"%d", &next_int) != EOF); i++){
-        if(i == arr_space){
-            arr_space *= 2;
-            int_arr = (int*)realloc(int_arr, sizeof(int) * arr_space);
-            if(int_arr == NULL){
-                perror(PROGNAME ": error: error allocating memory");
-                exit(1);
-            }
-        }
-        int_arr[i] = next_int;
+    //Map a binary .i32 file, or parse a text file with all processors.
+    t0 = index_now();
+    if(intfile_load(&input, fname, 0) != 0){
+        perror(PROGNAME ": error: problem reading file");
+        exit(1);
+    }
+    int_arr = input.data;
+    if(input.count > INT_MAX){
+        fprintf(stderr, PROGNAME ": error: too many values to process!\n");
+        exit(1);
     }
-    fclose(f);
+    i = input.count;
 
     if(i == 0){
         fprintf(stderr, PROGNAME ": error: no values to process!\n");
         exit(1);
     }
+    if(INDEX_PHASES)
+        fprintf(stderr, PROGNAME ": loaded %d values in %.9f seconds\n", i, index_now() - t0);
 
     
 
@@ -151,22 +259,37 @@ int main(int argc, char **argv)
     //Call the threaded search algorithm.
     if(num_threads == 0){
         for(num_threads = 1; num_threads <= INDEX_THREAD_MAX; num_threads *= 2){
-#if INDEX_DEBUG_PROGRESS > 0
-            printf(PROGNAME ": starting search_tree_for_val...\n");
-#endif
-            search_array_for_val(int_arr, i, num_threads, search_val);
+            search(fname, int_arr, i, num_threads);
         }
     } else {
-#if INDEX_DEBUG_PROGRESS > 0
-            printf(PROGNAME ": starting search_tree_for_val...\n");
-#endif
-            search_array_for_val(int_arr, i, num_threads, search_val);
+            search(fname, int_arr, i, num_threads);
     }
 
+    t0 = index_now();
+    intfile_release(&input);
+    if(INDEX_PHASES)
+        fprintf(stderr, PROGNAME ": tore down in %.9f seconds\n", index_now() - t0);
 
     return 0;
 }
 
+//Search for search_val INDEX_REPEAT times, in the array, or if streaming,
+//in the file.
+void search(const char *fname, int *array, int array_size, int num_threads)
+{
+    int r;
+
+    for(r = 0; r < INDEX_REPEAT; r++){
+#if INDEX_DEBUG_PROGRESS > 0
+        printf(PROGNAME ": starting search_tree_for_val...\n");
+#endif
+        if(INDEX_STREAM_CHUNK > 0)
+            stream_search_for_val(fname, num_threads, search_val);
+        else
+            search_array_for_val(array, array_size, num_threads, search_val);
+    }
+}
+
 int search_array_for_val(int *array, int array_size, int num_threads, int val)
 {
     int i, work_size;
@@ -174,7 +297,7 @@ int search_array_for_val(int *array, int array_size, int num_threads, int val)
     index_thread_args *args;
 
     search_val = val;
-    val_found = 0;
+    atomic_store(&val_found, 0);
     work_size = array_size / num_threads;
 
     //Allocate threads and thread arg structs
@@ -197,22 +320,32 @@ int search_array_for_val(int *array, int array_size, int num_threads, int val)
     }
 
     //Timing vars
-    float search_time;
-    struct timeval t0, t1;
-    gettimeofday(&t0, NULL);
+    double search_time;
+    double t0, spawned, last_stop, joined;
+    t0 = index_now();
 
     //Create threads
     for(i = 0; i < num_threads; i++){
         pthread_create(&threads[i], NULL, thread_search_array, &args[i]);
     }
+    spawned = index_now();
 
     //Join threads 
     for(i = 0; i < num_threads; i++){
         pthread_join(threads[i], NULL);
     }
+    joined = index_now();
+    search_time = joined - t0;
 
-    gettimeofday(&t1, NULL);
-    search_time = (float)(t1.tv_sec - t0.tv_sec) + ((float)(t1.tv_usec - t0.tv_usec)/1000000.0);
+    //Threads that finished before the last one was created searched
+    //during the spawn phase.
+    last_stop = spawned;
+    for(i = 0; i < num_threads; i++){
+        if(args[i].stop > last_stop) last_stop = args[i].stop;
+    }
+    if(INDEX_PHASES)
+        fprintf(stderr, PROGNAME ": phases spawn %.9f search %.9f join %.9f\n",
+                spawned - t0, last_stop - spawned, joined - last_stop);
 
 #if INDEX_DEBUG_TIME > 0
     printf(PROGNAME ": search (wall clock) time %f\n", search_time);
@@ -220,7 +353,7 @@ int search_array_for_val(int *array, int array_size, int num_threads, int val)
 
 
 #if INDEX_DEBUG_PROGRESS > 0
-    if(val_found == 0){
+    if(atomic_load(&val_found) == 0){
         printf(PROGNAME ": value not found!\n");
     } else {
         printf(PROGNAME ": value found!\n");
@@ -229,44 +362,269 @@ int search_array_for_val(int *array, int array_size, int num_threads, int val)
 #endif
 
     //printf("size\t\tthreads\t\ttime\n");
-    printf("%d\t\t%d\t\t%f\t\t%d\n", array_size, num_threads, search_time, val_found);
+    printf("%d\t\t%d\t\t%.9f\t\t%d\n", array_size, num_threads, search_time, atomic_load(&val_found));
 
+    free(threads);
+    free(args);
     return 0;
 }
 
 void *thread_search_array(void *args)
 {
-    int i, id, *array, start, end;
+    int *array, start, end;
+    long k;
     index_thread_args ta = *((index_thread_args *)args);
 
-    id = ta.id;
     array = ta.array;
     start = ta.start;
     end = ta.end;
 
 #if INDEX_DEBUG_THREADS > 0
-    printf("thread %d: search index from %d to %d...\n", id, start, end);
+    printf("thread %d: search index from %d to %d...\n", ta.id, start, end);
 #endif
 
-    for(i = start; i < end; i++){
-        //Check to see if we are done
-        if(val_found){
-            break;
-        }
-
-        if(array[i] == search_val){
-            pthread_mutex_lock(&val_found_mutex);
-                val_found = 1;
-            pthread_mutex_unlock(&val_found_mutex);
+    k = scan_for_val(&array[start], end - start);
+    if(k >= 0){
+        atomic_store(&val_found, 1);
 #if INDEX_DEBUG_THREADS > 0
-            printf("thread %d: value %d found at index %d!\n", id, array[i], i);
+        printf("thread %d: value %d found at index %ld!\n", ta.id, array[start+k], start+k);
 #endif
-        }
     }
 
 #if INDEX_DEBUG_THREADS > 0
-    printf("thread %d: exiting...\n", id);
+    printf("thread %d: exiting...\n", ta.id);
 #endif
+    ((index_thread_args *)args)->stop = index_now();
     pthread_exit(0);
 }
 
+//Index of the first of vals[0..n) equal to search_val, or -1 if there is
+//none or another thread found it first.
+long scan_for_val(int *vals, long n)
+{
+    long i, k, len;
+
+    if(INDEX_SCAN_ELEMENT){
+        for(i = 0; i < n; i++){
+            //Check to see if we are done
+            if(atomic_load_explicit(&val_found, memory_order_relaxed)) break;
+            if(vals[i] == search_val) return i;
+        }
+        return -1;
+    }
+
+    for(i = 0; i < n && !atomic_load_explicit(&val_found, memory_order_relaxed); i += len){
+        len = (n - i < INDEX_SCAN_BLOCK) ? n - i : INDEX_SCAN_BLOCK;
+        if((k = dsp_scan_eq(&vals[i], len, search_val)) >= 0) return i + k;
+    }
+    return -1;
+}
+
+//Search the file for val while it is read, with num_threads search threads
+//and a reader. Prints a result line like search_array_for_val, with the
+//values scanned as the size.
+int stream_search_for_val(const char *fname, int num_threads, int val)
+{
+    index_stream *st = &search_stream;
+    index_thread_args *args;
+    pthread_t reader;
+    double t0, spawned, last_stop, joined;
+    int i;
+
+    search_val = val;
+    atomic_store(&val_found, 0);
+
+    if(intfile_stream_open(&stream_file, fname) != 0){
+        perror(PROGNAME ": error: problem reading file");
+        exit(1);
+    }
+
+    //Two chunks a thread, so each can have one waiting while it scans.
+    st->num_chunks = 2 * num_threads + 1;
+    st->chunks = (index_chunk *)malloc(sizeof(index_chunk) * st->num_chunks);
+    st->full = (int *)malloc(sizeof(int) * st->num_chunks);
+    st->empty = (int *)malloc(sizeof(int) * st->num_chunks);
+    threads = (pthread_t *)malloc(sizeof(pthread_t) * num_threads);
+    args = (index_thread_args *)malloc(sizeof(index_thread_args) * num_threads);
+    if(st->chunks == NULL || st->full == NULL || st->empty == NULL ||
+       threads == NULL || args == NULL){
+        perror(PROGNAME "error: error allocating stream");
+        exit(1);
+    }
+    for(i = 0; i < st->num_chunks; i++){
+        st->chunks[i].bytes = (char *)malloc(INDEX_STREAM_CHUNK);
+        if(st->chunks[i].bytes == NULL){
+            perror(PROGNAME "error: error allocating stream");
+            exit(1);
+        }
+        st->empty[i] = i;
+    }
+    st->full_head = st->full_count = 0;
+    st->empty_head = 0;
+    st->empty_count = st->num_chunks;
+    st->reader_done = 0;
+    st->values = 0;
+    st->bytes = 0;
+    pthread_mutex_init(&st->ring_lock, NULL);
+    pthread_cond_init(&st->ring_filled, NULL);
+    pthread_cond_init(&st->ring_emptied, NULL);
+
+    t0 = index_now();
+    pthread_create(&reader, NULL, thread_read_stream, NULL);
+    for(i = 0; i < num_threads; i++){
+        args[i].id = i;
+        pthread_create(&threads[i], NULL, thread_search_stream, &args[i]);
+    }
+    spawned = index_now();
+
+    pthread_join(reader, NULL);
+    for(i = 0; i < num_threads; i++){
+        pthread_join(threads[i], NULL);
+    }
+    joined = index_now();
+
+    last_stop = spawned;
+    for(i = 0; i < num_threads; i++){
+        if(args[i].stop > last_stop) last_stop = args[i].stop;
+    }
+    if(INDEX_PHASES){
+        fprintf(stderr, PROGNAME ": read %lu bytes\n", st->bytes);
+        fprintf(stderr, PROGNAME ": phases spawn %.9f search %.9f join %.9f\n",
+                spawned - t0, last_stop - spawned, joined - last_stop);
+    }
+
+    //printf("size\t\tthreads\t\ttime\n");
+    printf("%lu\t\t%d\t\t%.9f\t\t%d\n", st->values, num_threads, joined - t0, atomic_load(&val_found));
+
+    intfile_stream_close(&stream_file);
+    for(i = 0; i < st->num_chunks; i++){
+        free(st->chunks[i].bytes);
+    }
+    free(st->chunks);
+    free(st->full);
+    free(st->empty);
+    free(threads);
+    free(args);
+    pthread_mutex_destroy(&st->ring_lock);
+    pthread_cond_destroy(&st->ring_filled);
+    pthread_cond_destroy(&st->ring_emptied);
+    return 0;
+}
+
+//Fill free chunks from the file and queue them, until the file ends or
+//the value is found.
+void *thread_read_stream(void *args)
+{
+    index_stream *st = &search_stream;
+    index_chunk *chunk;
+    long len;
+    int c;
+
+    while(1){
+        pthread_mutex_lock(&st->ring_lock);
+        while(st->empty_count == 0 && !atomic_load_explicit(&val_found, memory_order_relaxed))
+            pthread_cond_wait(&st->ring_emptied, &st->ring_lock);
+        if(atomic_load_explicit(&val_found, memory_order_relaxed)){
+            pthread_mutex_unlock(&st->ring_lock);
+            break;
+        }
+        c = st->empty[st->empty_head];
+        st->empty_head = (st->empty_head + 1) % st->num_chunks;
+        st->empty_count--;
+        pthread_mutex_unlock(&st->ring_lock);
+
+        chunk = &st->chunks[c];
+        len = intfile_stream_read(&stream_file, chunk->bytes, INDEX_STREAM_CHUNK);
+        if(len < 0){
+            perror(PROGNAME ": error: problem reading file");
+            exit(1);
+        }
+        if(len == 0) break;
+        chunk->len = len;
+
+        pthread_mutex_lock(&st->ring_lock);
+        st->full[(st->full_head + st->full_count) % st->num_chunks] = c;
+        st->full_count++;
+        st->bytes += len;
+        pthread_cond_signal(&st->ring_filled);
+        pthread_mutex_unlock(&st->ring_lock);
+    }
+
+    pthread_mutex_lock(&st->ring_lock);
+    st->reader_done = 1;
+    pthread_cond_broadcast(&st->ring_filled);
+    pthread_mutex_unlock(&st->ring_lock);
+    return NULL;
+}
+
+//Scan full chunks as the reader queues them, until there are no more or
+//the value is found.
+void *thread_search_stream(void *args)
+{
+    index_stream *st = &search_stream;
+    index_chunk *chunk;
+    int *scratch = NULL, *vals;
+    long i, count;
+    int c, found = 0;
+
+    //Text has to be parsed somewhere to scan it.
+    if(!stream_file.binary){
+        scratch = (int *)malloc(sizeof(int) * INTFILE_STREAM_MAX_VALUES(INDEX_STREAM_CHUNK));
+        if(scratch == NULL){
+            perror(PROGNAME "error: error allocating stream");
+            exit(1);
+        }
+    }
+
+    while(1){
+        pthread_mutex_lock(&st->ring_lock);
+        while(st->full_count == 0 && !st->reader_done &&
+              !atomic_load_explicit(&val_found, memory_order_relaxed))
+            pthread_cond_wait(&st->ring_filled, &st->ring_lock);
+        if(atomic_load_explicit(&val_found, memory_order_relaxed) || st->full_count == 0){
+            pthread_mutex_unlock(&st->ring_lock);
+            break;
+        }
+        c = st->full[st->full_head];
+        st->full_head = (st->full_head + 1) % st->num_chunks;
+        st->full_count--;
+        pthread_mutex_unlock(&st->ring_lock);
+
+        chunk = &st->chunks[c];
+        count = intfile_stream_decode(&stream_file, chunk->bytes, chunk->len, scratch, &vals);
+        if(count < 0){
+            perror(PROGNAME ": error: problem reading file");
+            exit(1);
+        }
+        i = scan_for_val(vals, count);
+        found = (i >= 0);
+
+        pthread_mutex_lock(&st->ring_lock);
+        st->values += found ? i + 1 : count;
+        st->empty[(st->empty_head + st->empty_count) % st->num_chunks] = c;
+        st->empty_count++;
+        if(found){
+            atomic_store(&val_found, 1);
+            pthread_cond_broadcast(&st->ring_filled);
+            pthread_cond_broadcast(&st->ring_emptied);
+        } else {
+            pthread_cond_signal(&st->ring_emptied);
+        }
+        pthread_mutex_unlock(&st->ring_lock);
+        if(found) break;
+    }
+
+    free(scratch);
+    ((index_thread_args *)args)->stop = index_now();
+    return NULL;
+}
+
+//Monotonic wall clock time in seconds.
+double index_now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+}
+
@@ -0,0 +1,415 @@
+//Written by David Ells
+//
+//Loading of the integer input files used by dfs-search and index-search.
+//See intfile.h.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "intfile.h"
+
+//Text is not split into pieces smaller than this for the parser threads.
+#define INTFILE_MIN_CHUNK (1024 * 1024)
+#define INTFILE_THREAD_MAX 128
+
+typedef struct {
+    const char *start;
+    const char *end;
+    int *out;               //NULL on the counting pass
+    unsigned long count;
+    int error;
+} intfile_chunk;
+
+static int host_is_big_endian()
+{
+    uint16_t x = 1;
+    return *((unsigned char *)&x) == 0;
+}
+
+static uint32_t swap32(uint32_t x)
+{
+    return ((x & 0xff) << 24) | ((x & 0xff00) << 8) |
+           ((x >> 8) & 0xff00) | (x >> 24);
+}
+
+static uint64_t swap64(uint64_t x)
+{
+    return ((uint64_t)swap32((uint32_t)x) << 32) | swap32((uint32_t)(x >> 32));
+}
+
+static int is_space(char c)
+{
+    return (c == ' ' || c == '\n' || c == '\t' || c == '\r' ||
+            c == '\v' || c == '\f');
+}
+
+//Count (or, if out is set, also store) the integers in one chunk of text.
+//Each chunk starts and ends on a token boundary.
+static void *parse_chunk(void *arg)
+{
+    intfile_chunk *c = (intfile_chunk *)arg;
+    const char *p = c->start;
+    const char *end = c->end;
+    unsigned long n = 0;
+    long long v;
+    int neg;
+
+    while(1){
+        while(p < end && is_space(*p)) p++;
+        if(p == end) break;
+
+        neg = 0;
+        if(*p == '-' || *p == '+'){
+            neg = (*p == '-');
+            p++;
+        }
+        if(p == end || *p < '0' || *p > '9'){
+            c->error = EINVAL;
+            break;
+        }
+        v = 0;
+        while(p < end && *p >= '0' && *p <= '9'){
+            v = v * 10 + (*p - '0');
+            if(v > (long long)INT_MAX + 1){
+                c->error = ERANGE;
+                break;
+            }
+            p++;
+        }
+        if(c->error) break;
+        if(p < end && !is_space(*p)){
+            c->error = EINVAL;
+            break;
+        }
+        if(v > INT_MAX && !neg){
+            c->error = ERANGE;
+            break;
+        }
+
+        if(c->out != NULL) c->out[n] = (int)(neg ? -v : v);
+        n++;
+    }
+    c->count = n;
+    return NULL;
+}
+
+//Run parse_chunk over every chunk, one thread each. A chunk whose thread
+//can't be created is parsed by the calling thread instead.
+static int parse_chunks(intfile_chunk *chunks, int num_chunks)
+{
+    int i, err = 0;
+    pthread_t threads[INTFILE_THREAD_MAX];
+    int started[INTFILE_THREAD_MAX];
+
+    for(i = 1; i < num_chunks; i++){
+        started[i] = (pthread_create(&threads[i], NULL, parse_chunk, &chunks[i]) == 0);
+        if(!started[i]) parse_chunk(&chunks[i]);
+    }
+    parse_chunk(&chunks[0]);
+    for(i = 1; i < num_chunks; i++){
+        if(started[i]) pthread_join(threads[i], NULL);
+    }
+    for(i = 0; i < num_chunks; i++){
+        if(chunks[i].error) err = chunks[i].error;
+    }
+    return err;
+}
+
+static int load_text(intfile_t *f, const char *text, size_t len, int num_threads)
+{
+    intfile_chunk chunks[INTFILE_THREAD_MAX];
+    const char *p;
+    unsigned long total;
+    int i, num_chunks, err;
+
+    num_chunks = num_threads;
+    if((size_t)num_chunks > len / INTFILE_MIN_CHUNK)
+        num_chunks = len / INTFILE_MIN_CHUNK;
+    if(num_chunks < 1) num_chunks = 1;
+
+    //Split evenly, then slide each boundary past the token it landed in.
+    for(i = 0; i < num_chunks; i++){
+        p = text + (len / num_chunks) * i;
+        if(i > 0){
+            while(p < text + len && !is_space(*p)) p++;
+            chunks[i-1].end = p;
+        }
+        chunks[i].start = p;
+        chunks[i].out = NULL;
+        chunks[i].error = 0;
+    }
+    chunks[num_chunks-1].end = text + len;
+
+    //First pass counts, so each chunk knows where its values go.
+    if((err = parse_chunks(chunks, num_chunks)) != 0){
+        errno = err;
+        return -1;
+    }
+    total = 0;
+    for(i = 0; i < num_chunks; i++){
+        total += chunks[i].count;
+    }
+
+    f->count = total;
+    if(total == 0) return 0;
+    f->data = (int *)malloc(sizeof(int) * total);
+    if(f->data == NULL) return -1;
+
+    total = 0;
+    for(i = 0; i < num_chunks; i++){
+        chunks[i].out = f->data + total;
+        total += chunks[i].count;
+    }
+    if((err = parse_chunks(chunks, num_chunks)) != 0){
+        free(f->data);
+        f->data = NULL;
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+//Load the named file into f, parsing text with up to num_threads threads
+//(0 for one per online processor). Returns 0 on success, or -1 with errno
+//set: EINVAL for malformed input, ERANGE for a value that overflows an int.
+int intfile_load(intfile_t *f, const char *fname, int num_threads)
+{
+    int fd, err;
+    struct stat st;
+    char *map;
+    intfile_header h;
+    unsigned long i;
+    uint64_t count;
+
+    f->data = NULL;
+    f->count = 0;
+    f->map = NULL;
+    f->map_len = 0;
+
+    if(num_threads <= 0) num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if(num_threads < 1) num_threads = 1;
+    if(num_threads > INTFILE_THREAD_MAX) num_threads = INTFILE_THREAD_MAX;
+
+    if((fd = open(fname, O_RDONLY)) < 0) return -1;
+    if(fstat(fd, &st) < 0){
+        err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    if(st.st_size == 0){
+        close(fd);
+        return 0;
+    }
+
+    //Binary files are mapped copy on write, so a big endian host can swap
+    //the values in place.
+    map = (char *)mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    err = errno;
+    close(fd);
+    if(map == MAP_FAILED){
+        errno = err;
+        return -1;
+    }
+
+    if((size_t)st.st_size >= sizeof(h) &&
+       memcmp(map, INTFILE_MAGIC, INTFILE_MAGIC_LEN) == 0){
+        memcpy(&h, map, sizeof(h));
+        count = host_is_big_endian() ? swap64(h.count) : h.count;
+        if(count > ((size_t)st.st_size - sizeof(h)) / sizeof(int)){
+            munmap(map, st.st_size);
+            errno = EINVAL;
+            return -1;
+        }
+        f->map = map;
+        f->map_len = st.st_size;
+        f->data = (int *)(map + sizeof(h));
+        f->count = count;
+        madvise(map, st.st_size, MADV_SEQUENTIAL);
+        if(host_is_big_endian()){
+            for(i = 0; i < f->count; i++){
+                f->data[i] = (int)swap32((uint32_t)f->data[i]);
+            }
+        }
+        return 0;
+    }
+
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    err = load_text(f, map, st.st_size, num_threads);
+    munmap(map, st.st_size);
+    return err;
+}
+
+void intfile_release(intfile_t *f)
+{
+    if(f->map != NULL)
+        munmap(f->map, f->map_len);
+    else
+        free(f->data);
+    f->data = NULL;
+    f->count = 0;
+    f->map = NULL;
+    f->map_len = 0;
+}
+
+//Read up to len bytes, retrying short reads. Returns the number read,
+//less than len only at the end of the file, or -1 on error.
+static ssize_t read_full(int fd, char *buf, size_t len)
+{
+    size_t done = 0;
+    ssize_t n;
+
+    while(done < len){
+        n = read(fd, buf + done, len - done);
+        if(n < 0 && errno == EINTR) continue;
+        if(n < 0) return -1;
+        if(n == 0) break;
+        done += n;
+    }
+    return done;
+}
+
+//Open the named file for streaming. Returns 0 on success, or -1 with
+//errno set.
+int intfile_stream_open(intfile_stream_t *s, const char *fname)
+{
+    intfile_header h;
+    ssize_t n;
+    int err;
+
+    s->binary = 0;
+    s->left = 0;
+    s->carry_len = 0;
+    if((s->fd = open(fname, O_RDONLY)) < 0) return -1;
+    posix_fadvise(s->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    if((n = read_full(s->fd, (char *)&h, sizeof(h))) < 0){
+        err = errno;
+        close(s->fd);
+        errno = err;
+        return -1;
+    }
+    if((size_t)n == sizeof(h) && memcmp(h.magic, INTFILE_MAGIC, INTFILE_MAGIC_LEN) == 0){
+        s->binary = 1;
+        s->left = (host_is_big_endian() ? swap64(h.count) : h.count) * sizeof(int);
+    } else {
+        //Text, and what was read is the start of the first window.
+        memcpy(s->carry, &h, n);
+        s->carry_len = n;
+    }
+    return 0;
+}
+
+//Read the next window of at most size bytes (more than INTFILE_CARRY_MAX)
+//into buf, which must be aligned for ints. A text window that stops inside
+//a token ends before it, and the token starts the next one. Returns the
+//bytes in the window, 0 at the end of the file, or -1 with errno set
+//(EINVAL for a token too long or a binary file cut short).
+long intfile_stream_read(intfile_stream_t *s, char *buf, size_t size)
+{
+    ssize_t n;
+    size_t len, end, want;
+
+    if(s->binary){
+        len = size - size % sizeof(int);
+        if(len > s->left) len = s->left;
+        if((n = read_full(s->fd, buf, len)) < 0) return -1;
+        if((size_t)n < len){
+            errno = EINVAL;
+            return -1;
+        }
+        s->left -= len;
+        return len;
+    }
+
+    memcpy(buf, s->carry, s->carry_len);
+    want = size - s->carry_len;
+    if((n = read_full(s->fd, buf + s->carry_len, want)) < 0) return -1;
+    len = s->carry_len + n;
+    s->carry_len = 0;
+    if((size_t)n < want) return len;
+
+    end = len;
+    while(end > 0 && !is_space(buf[end-1])) end--;
+    if(len - end > INTFILE_CARRY_MAX){
+        errno = EINVAL;
+        return -1;
+    }
+    memcpy(s->carry, buf + end, len - end);
+    s->carry_len = len - end;
+    return end;
+}
+
+//Turn a window of len bytes read into buf into ints, pointed to by *vals:
+//in place for a binary file, else parsed into scratch, which must hold
+//INTFILE_STREAM_MAX_VALUES(len) ints. Safe to call from several threads
+//on different windows. Returns the number of ints, or -1 with errno set.
+long intfile_stream_decode(intfile_stream_t *s, char *buf, size_t len, int *scratch,
+                           int **vals)
+{
+    intfile_chunk c;
+    unsigned long i;
+
+    if(s->binary){
+        *vals = (int *)buf;
+        if(host_is_big_endian()){
+            for(i = 0; i < len / sizeof(int); i++){
+                (*vals)[i] = (int)swap32((uint32_t)(*vals)[i]);
+            }
+        }
+        return len / sizeof(int);
+    }
+
+    c.start = buf;
+    c.end = buf + len;
+    c.out = scratch;
+    c.error = 0;
+    parse_chunk(&c);
+    if(c.error){
+        errno = c.error;
+        return -1;
+    }
+    *vals = scratch;
+    return c.count;
+}
+
+void intfile_stream_close(intfile_stream_t *s)
+{
+    close(s->fd);
+    s->fd = -1;
+}
+
+//Write the header of a binary file holding count ints. Returns 0 on success.
+int intfile_write_header(FILE *out, uint64_t count)
+{
+    intfile_header h;
+
+    memcpy(h.magic, INTFILE_MAGIC, INTFILE_MAGIC_LEN);
+    h.count = host_is_big_endian() ? swap64(count) : count;
+    return (fwrite(&h, sizeof(h), 1, out) == 1) ? 0 : -1;
+}
+
+//Append n ints to a binary file, little endian. Returns 0 on success.
+int intfile_write_ints(FILE *out, const int *vals, size_t n)
+{
+    uint32_t buf[1024];
+    size_t i, j, len;
+
+    if(!host_is_big_endian())
+        return (fwrite(vals, sizeof(int), n, out) == n) ? 0 : -1;
+
+    for(i = 0; i < n; i += len){
+        len = (n - i < 1024) ? n - i : 1024;
+        for(j = 0; j < len; j++){
+            buf[j] = swap32((uint32_t)vals[i + j]);
+        }
+        if(fwrite(buf, sizeof(uint32_t), len, out) != len) return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,60 @@
+//Written by David Ells
+//
+//Loading of the integer input files used by dfs-search and index-search.
+//
+//Two formats are understood. Text files hold whitespace separated decimal
+//integers, as written by randints; they are parsed in parallel. Binary
+//.i32 files (randints --binary) hold an intfile_header followed by count
+//little endian 32 bit ints, and are mapped straight into memory.
+//
+//Files too big to load can be streamed instead: read a window at a time
+//with intfile_stream_read, each window ending on a value boundary, and
+//turned into ints with intfile_stream_decode, possibly by other threads.
+
+#ifndef INTFILE_H
+#define INTFILE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define INTFILE_MAGIC "DSPI32v1"
+#define INTFILE_MAGIC_LEN 8
+
+//16 bytes, so the ints that follow are aligned in the mapping.
+typedef struct {
+    char magic[INTFILE_MAGIC_LEN];
+    uint64_t count;     //little endian
+} intfile_header;
+
+typedef struct {
+    int *data;
+    unsigned long count;
+    void *map;          //mapping that data points into, or NULL if malloc'd
+    size_t map_len;
+} intfile_t;
+
+//Longest text token carried from one window to the next. Windows must be
+//bigger than this.
+#define INTFILE_CARRY_MAX 64
+
+//Ints that decoding a text window of len bytes can produce at most.
+#define INTFILE_STREAM_MAX_VALUES(len) (((len) + 1) / 2)
+
+typedef struct {
+    int fd;
+    int binary;
+    uint64_t left;                  //binary: bytes of values still to read
+    char carry[INTFILE_CARRY_MAX];  //text: start of the next window
+    size_t carry_len;
+} intfile_stream_t;
+
+int intfile_load(intfile_t *, const char *, int);
+void intfile_release(intfile_t *);
+int intfile_stream_open(intfile_stream_t *, const char *);
+long intfile_stream_read(intfile_stream_t *, char *, size_t);
+long intfile_stream_decode(intfile_stream_t *, char *, size_t, int *, int **);
+void intfile_stream_close(intfile_stream_t *);
+int intfile_write_header(FILE *, uint64_t);
+int intfile_write_ints(FILE *, const int *, size_t);
+
+#endif
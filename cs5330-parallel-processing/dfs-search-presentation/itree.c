@@ -0,0 +1,35 @@
+//Written by David Ells
+//
+//An implicit binary tree ADT. See itree.h.
+
+#include "itree.h"
+
+//The tree uses values in place, it does not copy them.
+void itree_init(itree *t, int *values, unsigned long node_count)
+{
+    t->values = values;
+    t->node_count = node_count;
+}
+
+void itreenode_print(itree *t, unsigned long i, FILE *f)
+{
+    fprintf(f, "node %lu:", i);
+    if(ITREE_LEFT(i) < t->node_count)
+        fprintf(f, " left:%lu", ITREE_LEFT(i));
+    if(ITREE_RIGHT(i) < t->node_count)
+        fprintf(f, " right:%lu", ITREE_RIGHT(i));
+    fprintf(f, "\n");
+}
+
+void itree_visit_r(itree *t, unsigned long i, itreenode_func func, void *arg)
+{
+    if(i >= t->node_count) return;
+    (*func)(t, i, arg);
+    itree_visit_r(t, ITREE_LEFT(i), func, arg);
+    itree_visit_r(t, ITREE_RIGHT(i), func, arg);
+}
+
+void itree_visit(itree *t, itreenode_func func, void *arg)
+{
+    itree_visit_r(t, 0, func, arg);
+}
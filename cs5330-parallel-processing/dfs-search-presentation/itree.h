@@ -0,0 +1,27 @@
+//Written by David Ells
+//
+//An implicit binary tree ADT over an array of values in breadth first
+//(Eytzinger) order: node i has children 2i+1 and 2i+2, and the tree has
+//no child pointers at all. Only complete, heap shaped trees fit this.
+
+#ifndef ITREE_H
+#define ITREE_H
+
+#include <stdio.h>
+
+typedef struct {
+    int *values;
+    unsigned long node_count;
+} itree;
+
+#define ITREE_LEFT(i) (2 * (i) + 1)
+#define ITREE_RIGHT(i) (2 * (i) + 2)
+
+typedef void (*itreenode_func)(itree *, unsigned long, void *);
+
+void itree_init(itree *, int *, unsigned long);
+void itreenode_print(itree *, unsigned long, FILE *);
+void itree_visit_r(itree *, unsigned long, itreenode_func, void *);
+void itree_visit(itree *, itreenode_func, void *);
+
+#endif
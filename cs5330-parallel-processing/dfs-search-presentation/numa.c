@@ -0,0 +1,319 @@
+//Written by David Ells
+//
+//NUMA topology, thread pinning and page placement. See numa.h.
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "numa.h"
+
+#define DSP_NUMA_MAX_NODES 64
+#define DSP_NUMA_SYSFS "/sys/devices/system/node"
+
+typedef struct {
+    dsp_numa_t *numa;
+    atomic_int failed;
+} pin_job;
+
+typedef struct {
+    int num_threads;
+    char *start;            //start of the first page of the array
+    char *ptr;              //the array itself
+    size_t num_pages;
+    size_t page_size;
+    dsp_numa_placement placement;
+} place_job;
+
+//Add the CPUs of a sysfs style list ("0-3,8,10-11") to node. Returns 0, or
+//-1 with errno set.
+static int add_cpus(dsp_numa_t *t, int node, const char *list)
+{
+    const char *p = list;
+    char *end;
+    long a, b, c;
+    int *cpus;
+
+    while(*p != '\0' && *p != '\n'){
+        a = strtol(p, &end, 10);
+        if(end == p || a < 0) goto bad;
+        b = a;
+        p = end;
+        if(*p == '-'){
+            b = strtol(p + 1, &end, 10);
+            if(end == p + 1 || b < a) goto bad;
+            p = end;
+        }
+        if(*p == ',') p++;
+        else if(*p != '\0' && *p != '\n') goto bad;
+
+        cpus = (int *)realloc(t->node_cpus[node],
+                              sizeof(int) * (t->node_cpu_count[node] + (b - a + 1)));
+        if(cpus == NULL) return -1;
+        t->node_cpus[node] = cpus;
+        for(c = a; c <= b; c++){
+            cpus[t->node_cpu_count[node]++] = (int)c;
+        }
+    }
+    return 0;
+
+bad:
+    errno = EINVAL;
+    return -1;
+}
+
+static int add_all_cpus(dsp_numa_t *);
+
+static int load_sysfs(dsp_numa_t *t)
+{
+    char path[256], line[4096];
+    FILE *f;
+    int node;
+
+    for(node = 0; node < DSP_NUMA_MAX_NODES; node++){
+        snprintf(path, sizeof(path), DSP_NUMA_SYSFS "/node%d/cpulist", node);
+        if((f = fopen(path, "r")) == NULL) continue;
+        if(fgets(line, sizeof(line), f) == NULL) line[0] = '\0';
+        fclose(f);
+        //Nodes are renumbered densely; memory only nodes are left out.
+        if(add_cpus(t, t->num_nodes, line) != 0) return -1;
+        if(t->node_cpu_count[t->num_nodes] > 0) t->num_nodes++;
+    }
+    return 0;
+}
+
+static int load_config(dsp_numa_t *t, const char *fname)
+{
+    char line[4096], list[4096];
+    char *hash;
+    FILE *f;
+    int node, err = 0;
+
+    if((f = fopen(fname, "r")) == NULL) return -1;
+    while(fgets(line, sizeof(line), f) != NULL){
+        if((hash = strchr(line, '#')) != NULL) *hash = '\0';
+        if(sscanf(line, "%d %4095s", &node, list) != 2){
+            if(sscanf(line, " %4095s", list) == 1) err = EINVAL;
+            continue;
+        }
+        //Nodes have to come in order, though a node may have several lines.
+        if(node < 0 || node >= DSP_NUMA_MAX_NODES || node > t->num_nodes){
+            err = EINVAL;
+            break;
+        }
+        if(add_cpus(t, node, list) != 0){
+            err = errno;
+            break;
+        }
+        if(node == t->num_nodes) t->num_nodes++;
+    }
+    fclose(f);
+    if(err == 0 && t->num_nodes == 0) err = EINVAL;
+    if(err != 0){
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+//Read the topology from the config file fname, or from sysfs if fname is
+//NULL. Returns 0, or -1 with errno set (EINVAL for a malformed config).
+int dsp_numa_load(dsp_numa_t *t, const char *fname)
+{
+    int err, node;
+
+    t->num_nodes = 0;
+    t->node_cpu_count = (int *)calloc(DSP_NUMA_MAX_NODES, sizeof(int));
+    t->node_cpus = (int **)calloc(DSP_NUMA_MAX_NODES, sizeof(int *));
+    if(t->node_cpu_count == NULL || t->node_cpus == NULL){
+        dsp_numa_destroy(t);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    if(fname != NULL ? load_config(t, fname) : load_sysfs(t)){
+        err = errno;
+        dsp_numa_destroy(t);
+        errno = err;
+        return -1;
+    }
+
+    //A node with no CPUs can't run a worker.
+    for(node = 0; node < t->num_nodes; node++){
+        if(t->node_cpu_count[node] == 0){
+            dsp_numa_destroy(t);
+            errno = EINVAL;
+            return -1;
+        }
+    }
+
+    //Without sysfs, act as one node holding every CPU we may run on.
+    t->known = (t->num_nodes > 0);
+    if(!t->known && add_all_cpus(t) != 0){
+        err = errno;
+        dsp_numa_destroy(t);
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+//Make node 0 of t hold the CPUs of the process affinity mask, or if that
+//can't be read, the CPUs online. Returns 0, or -1 with errno set.
+static int add_all_cpus(dsp_numa_t *t)
+{
+    cpu_set_t set;
+    long c, n;
+    int *cpus;
+
+    t->num_nodes = 1;
+    t->node_cpu_count[0] = 0;
+    if(sched_getaffinity(0, sizeof(set), &set) == 0){
+        n = CPU_COUNT(&set);
+    } else {
+        CPU_ZERO(&set);
+        n = sysconf(_SC_NPROCESSORS_ONLN);
+        if(n < 1) n = 1;
+        for(c = 0; c < n && c < CPU_SETSIZE; c++){
+            CPU_SET(c, &set);
+        }
+    }
+
+    cpus = (int *)realloc(t->node_cpus[0], sizeof(int) * n);
+    if(cpus == NULL) return -1;
+    t->node_cpus[0] = cpus;
+    for(c = 0; c < CPU_SETSIZE && t->node_cpu_count[0] < n; c++){
+        if(CPU_ISSET(c, &set)) cpus[t->node_cpu_count[0]++] = (int)c;
+    }
+    return 0;
+}
+
+void dsp_numa_destroy(dsp_numa_t *t)
+{
+    int i;
+
+    if(t->node_cpus != NULL){
+        for(i = 0; i < DSP_NUMA_MAX_NODES; i++){
+            free(t->node_cpus[i]);
+        }
+    }
+    free(t->node_cpus);
+    free(t->node_cpu_count);
+    t->node_cpus = NULL;
+    t->node_cpu_count = NULL;
+    t->num_nodes = 0;
+}
+
+int dsp_numa_thread_node(dsp_numa_t *t, int thread)
+{
+    return thread % t->num_nodes;
+}
+
+//Threads of a node take its CPUs in turn.
+int dsp_numa_thread_cpu(dsp_numa_t *t, int thread)
+{
+    int node = dsp_numa_thread_node(t, thread);
+
+    return t->node_cpus[node][(thread / t->num_nodes) % t->node_cpu_count[node]];
+}
+
+static void pin_worker(int id, void *arg)
+{
+    pin_job *job = (pin_job *)arg;
+    cpu_set_t set;
+    int cpu = dsp_numa_thread_cpu(job->numa, id);
+
+    CPU_ZERO(&set);
+    if(cpu >= CPU_SETSIZE ||
+       (CPU_SET(cpu, &set), pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) != 0){
+        atomic_fetch_add(&job->failed, 1);
+    }
+}
+
+//Pin every worker of pool to its CPU. Returns the number of workers that
+//could not be pinned, e.g. for naming a CPU this machine doesn't have;
+//those keep running wherever the scheduler puts them. Without a known
+//topology nothing is pinned, so all of them are counted.
+int dsp_numa_pin_pool(dsp_numa_t *t, dsp_pool_t *pool)
+{
+    pin_job job;
+
+    if(!t->known) return pool->num_threads;
+    job.numa = t;
+    atomic_init(&job.failed, 0);
+    dsp_pool_run(pool, pool->num_threads, pin_worker, &job);
+    return atomic_load(&job.failed);
+}
+
+//Write to page p of the array, staying inside the array: its first page
+//may be shared with other data.
+static void touch_page(place_job *job, size_t p)
+{
+    char *addr = job->start + p * job->page_size;
+
+    if(addr < job->ptr) addr = job->ptr;
+    *(volatile char *)addr = 0;
+}
+
+static void place_worker(int id, void *arg)
+{
+    place_job *job = (place_job *)arg;
+    size_t p, lo, hi;
+
+    if(job->placement == DSP_NUMA_PLACE_FIRST_TOUCH){
+        lo = job->num_pages * id / job->num_threads;
+        hi = job->num_pages * (id + 1) / job->num_threads;
+        for(p = lo; p < hi; p++){
+            touch_page(job, p);
+        }
+    } else {
+        for(p = id; p < job->num_pages; p += job->num_threads){
+            touch_page(job, p);
+        }
+    }
+}
+
+//Place the len bytes at ptr across the first num_threads workers of pool,
+//which should be pinned, by having each touch its pages. Must be called
+//on freshly allocated memory that nothing has written to yet; it writes
+//a zero to one byte of each page. With first touch, worker c gets
+//the c-th of num_threads equal pieces of the array, matching the chunks
+//a parallel build with num_threads threads writes.
+void dsp_numa_place(dsp_pool_t *pool, int num_threads, void *ptr, size_t len,
+                    dsp_numa_placement placement)
+{
+    place_job job;
+    uintptr_t start, end;
+
+    if(placement == DSP_NUMA_PLACE_NONE || len == 0) return;
+    if(num_threads > pool->num_threads) num_threads = pool->num_threads;
+    if(num_threads < 1) return;
+
+    job.page_size = sysconf(_SC_PAGESIZE);
+    start = (uintptr_t)ptr & ~(uintptr_t)(job.page_size - 1);
+    end = (uintptr_t)ptr + len;
+    job.start = (char *)start;
+    job.ptr = (char *)ptr;
+    job.num_pages = (end - start + job.page_size - 1) / job.page_size;
+    job.num_threads = num_threads;
+    job.placement = placement;
+    dsp_pool_run(pool, num_threads, place_worker, &job);
+}
+
+void dsp_numa_print(dsp_numa_t *t, FILE *f)
+{
+    int node, i;
+
+    for(node = 0; node < t->num_nodes; node++){
+        fprintf(f, "node %d: cpus", node);
+        for(i = 0; i < t->node_cpu_count[node]; i++){
+            fprintf(f, " %d", t->node_cpus[node][i]);
+        }
+        fprintf(f, "\n");
+    }
+}
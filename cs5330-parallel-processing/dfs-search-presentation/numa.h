@@ -0,0 +1,46 @@
+//Written by David Ells
+//
+//NUMA topology for dfs-search: which CPUs belong to which memory node,
+//which node and CPU each worker thread of a pool is pinned to, and the
+//placement of big arrays across the nodes.
+//
+//The topology is read from sysfs, or from a config file, which lets a
+//multi node machine be emulated on a single node one. The config has one
+//line per node, "<node> <cpulist>", with nodes numbered from 0 and the
+//cpulist in sysfs form (e.g. "0-3,8-11"); # starts a comment. Nodes may
+//share CPUs when emulating.
+//
+//Worker i runs on node i % num_nodes. Placement works by having the pinned
+//workers touch each page of an array before anything else does, since
+//Linux puts a page on the node of the CPU that first touches it. That
+//needs no libnuma and behaves the same on an emulated topology.
+
+#ifndef NUMA_H
+#define NUMA_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include "pool.h"
+
+typedef struct {
+    int num_nodes;
+    int known;              //0 if made up for want of sysfs: one node, no pinning
+    int *node_cpu_count;
+    int **node_cpus;
+} dsp_numa_t;
+
+typedef enum {
+    DSP_NUMA_PLACE_NONE,            //leave pages to whoever writes them first
+    DSP_NUMA_PLACE_FIRST_TOUCH,     //worker c of n gets the c-th n-th of the array
+    DSP_NUMA_PLACE_INTERLEAVE       //pages dealt round robin to the workers
+} dsp_numa_placement;
+
+int dsp_numa_load(dsp_numa_t *, const char *);
+void dsp_numa_destroy(dsp_numa_t *);
+int dsp_numa_thread_node(dsp_numa_t *, int);
+int dsp_numa_thread_cpu(dsp_numa_t *, int);
+int dsp_numa_pin_pool(dsp_numa_t *, dsp_pool_t *);
+void dsp_numa_place(dsp_pool_t *, int, void *, size_t, dsp_numa_placement);
+void dsp_numa_print(dsp_numa_t *, FILE *);
+
+#endif
@@ -0,0 +1,134 @@
+//Written by David Ells
+//
+//A pool of persistent worker threads. See pool.h.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "pool.h"
+
+struct dsp_pool_worker {
+    int id;
+    pthread_t thread;
+    dsp_pool_t *pool;
+    pthread_cond_t start_cond;      //waits here for its next job
+    unsigned long generation;       //last job it was given
+};
+
+static void *pool_worker_main(void *arg)
+{
+    dsp_pool_worker *w = (dsp_pool_worker *)arg;
+    dsp_pool_t *p = w->pool;
+    unsigned long seen = 0;
+    dsp_pool_func func;
+    void *job_arg;
+
+    while(1){
+        //Park until there is a new job or the pool is shutting down.
+        pthread_mutex_lock(&p->lock);
+        while(w->generation == seen && !p->shutdown){
+            pthread_cond_wait(&w->start_cond, &p->lock);
+        }
+        if(p->shutdown){
+            pthread_mutex_unlock(&p->lock);
+            break;
+        }
+        seen = w->generation;
+        func = p->func;
+        job_arg = p->arg;
+        pthread_mutex_unlock(&p->lock);
+
+        (*func)(w->id, job_arg);
+
+        pthread_mutex_lock(&p->lock);
+        p->running--;
+        if(p->running == 0)
+            pthread_cond_signal(&p->done_cond);
+        pthread_mutex_unlock(&p->lock);
+    }
+    return NULL;
+}
+
+//Create a pool of num_threads parked threads. Returns NULL on failure.
+dsp_pool_t *dsp_pool_create(int num_threads)
+{
+    dsp_pool_t *p;
+    int i;
+
+    p = (dsp_pool_t *)malloc(sizeof(dsp_pool_t));
+    if(p == NULL) return NULL;
+    p->workers = (dsp_pool_worker *)malloc(sizeof(dsp_pool_worker) * num_threads);
+    if(p->workers == NULL){
+        free(p);
+        return NULL;
+    }
+
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->done_cond, NULL);
+    p->generation = 0;
+    p->active = 0;
+    p->running = 0;
+    p->func = NULL;
+    p->arg = NULL;
+    p->shutdown = 0;
+
+    for(p->num_threads = 0; p->num_threads < num_threads; p->num_threads++){
+        i = p->num_threads;
+        p->workers[i].id = i;
+        p->workers[i].pool = p;
+        p->workers[i].generation = 0;
+        pthread_cond_init(&p->workers[i].start_cond, NULL);
+        if(pthread_create(&p->workers[i].thread, NULL, pool_worker_main,
+                          &p->workers[i]) != 0){
+            pthread_cond_destroy(&p->workers[i].start_cond);
+            dsp_pool_destroy(p);
+            return NULL;
+        }
+    }
+    return p;
+}
+
+//Run func on the first active workers of the pool and wait for all of them
+//to return. The rest stay parked. Must not be called from a pool thread.
+void dsp_pool_run(dsp_pool_t *p, int active, dsp_pool_func func, void *arg)
+{
+    int i;
+
+    if(active > p->num_threads) active = p->num_threads;
+    if(active <= 0) return;
+
+    pthread_mutex_lock(&p->lock);
+    p->func = func;
+    p->arg = arg;
+    p->active = active;
+    p->running = active;
+    p->generation++;
+    for(i = 0; i < active; i++){
+        p->workers[i].generation = p->generation;
+        pthread_cond_signal(&p->workers[i].start_cond);
+    }
+    while(p->running > 0){
+        pthread_cond_wait(&p->done_cond, &p->lock);
+    }
+    pthread_mutex_unlock(&p->lock);
+}
+
+void dsp_pool_destroy(dsp_pool_t *p)
+{
+    int i;
+
+    pthread_mutex_lock(&p->lock);
+    p->shutdown = 1;
+    for(i = 0; i < p->num_threads; i++){
+        pthread_cond_signal(&p->workers[i].start_cond);
+    }
+    pthread_mutex_unlock(&p->lock);
+
+    for(i = 0; i < p->num_threads; i++){
+        pthread_join(p->workers[i].thread, NULL);
+        pthread_cond_destroy(&p->workers[i].start_cond);
+    }
+    pthread_mutex_destroy(&p->lock);
+    pthread_cond_destroy(&p->done_cond);
+    free(p->workers);
+    free(p);
+}
@@ -0,0 +1,35 @@
+//Written by David Ells
+//
+//A pool of persistent worker threads. The threads are created once and
+//park on a condition variable of their own between jobs, so repeated
+//searches don't pay for pthread_create and pthread_join each time, and a
+//job only wakes the workers taking part in it.
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <pthread.h>
+
+//Job function, called with the worker's id (0 to active-1) and the job arg.
+typedef void (*dsp_pool_func)(int, void *);
+
+typedef struct dsp_pool_worker dsp_pool_worker;
+
+typedef struct {
+    int num_threads;
+    dsp_pool_worker *workers;
+    pthread_mutex_t lock;
+    pthread_cond_t done_cond;       //dsp_pool_run waits here for the job
+    unsigned long generation;       //bumped for each new job
+    int active;                     //workers taking part in the job
+    int running;                    //of those, how many are not done yet
+    dsp_pool_func func;
+    void *arg;
+    int shutdown;
+} dsp_pool_t;
+
+dsp_pool_t *dsp_pool_create(int);
+void dsp_pool_run(dsp_pool_t *, int, dsp_pool_func, void *);
+void dsp_pool_destroy(dsp_pool_t *);
+
+#endif
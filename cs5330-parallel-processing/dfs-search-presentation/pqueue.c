@@ -0,0 +1,176 @@
+//Written by David Ells
+//
+//Relaxed concurrent priority queue. See pqueue.h.
+
+#include <stdlib.h>
+#include "pqueue.h"
+
+#define DSP_PQ_MIN_SIZE 64
+
+//Create a MultiQueue of num_queues heaps, all active. Returns NULL on
+//failure.
+dsp_multiqueue_t *dsp_mq_create(int num_queues)
+{
+    dsp_multiqueue_t *mq;
+    int i;
+
+    mq = (dsp_multiqueue_t *)malloc(sizeof(dsp_multiqueue_t));
+    if(mq == NULL) return NULL;
+    if(posix_memalign((void **)&mq->queues, DSP_CACHELINE,
+                      sizeof(dsp_pq_t) * num_queues) != 0){
+        free(mq);
+        return NULL;
+    }
+    mq->num_queues = num_queues;
+    for(i = 0; i < num_queues; i++){
+        pthread_mutex_init(&mq->queues[i].lock, NULL);
+        atomic_init(&mq->queues[i].top, DSP_PQ_EMPTY);
+        mq->queues[i].heap = NULL;
+        mq->queues[i].count = 0;
+        mq->queues[i].size = 0;
+    }
+    mq->active = num_queues;
+    return mq;
+}
+
+//Empty every heap and use only the first active ones from now on. Must
+//not race with any other operation.
+void dsp_mq_reset(dsp_multiqueue_t *mq, int active)
+{
+    int i;
+
+    for(i = 0; i < mq->num_queues; i++){
+        mq->queues[i].count = 0;
+        atomic_store(&mq->queues[i].top, DSP_PQ_EMPTY);
+    }
+    if(active > mq->num_queues) active = mq->num_queues;
+    mq->active = (active < 1) ? 1 : active;
+}
+
+void dsp_mq_destroy(dsp_multiqueue_t *mq)
+{
+    int i;
+
+    for(i = 0; i < mq->num_queues; i++){
+        pthread_mutex_destroy(&mq->queues[i].lock);
+        free(mq->queues[i].heap);
+    }
+    free(mq->queues);
+    free(mq);
+}
+
+//Insert into one heap, with its lock held.
+static int pq_push(dsp_pq_t *q, uint64_t key, void *item)
+{
+    dsp_pq_entry *h;
+    long i, parent;
+
+    if(q->count == q->size){
+        h = (dsp_pq_entry *)realloc(q->heap, sizeof(dsp_pq_entry) *
+                                    ((q->size > 0) ? q->size * 2 : DSP_PQ_MIN_SIZE));
+        if(h == NULL) return 0;
+        q->heap = h;
+        q->size = (q->size > 0) ? q->size * 2 : DSP_PQ_MIN_SIZE;
+    }
+
+    h = q->heap;
+    for(i = q->count++; i > 0; i = parent){
+        parent = (i - 1) / 2;
+        if(h[parent].key <= key) break;
+        h[i] = h[parent];
+    }
+    h[i].key = key;
+    h[i].item = item;
+    atomic_store_explicit(&q->top, h[0].key, memory_order_relaxed);
+    return 1;
+}
+
+//Remove the smallest entry of a nonempty heap, with its lock held.
+static dsp_pq_entry pq_pop(dsp_pq_t *q)
+{
+    dsp_pq_entry *h = q->heap;
+    dsp_pq_entry min = h[0], last;
+    long i, child, n;
+
+    n = --q->count;
+    last = h[n];
+    for(i = 0; (child = 2*i + 1) < n; i = child){
+        if(child + 1 < n && h[child + 1].key < h[child].key) child++;
+        if(last.key <= h[child].key) break;
+        h[i] = h[child];
+    }
+    if(n > 0) h[i] = last;
+    atomic_store_explicit(&q->top, (n > 0) ? h[0].key : DSP_PQ_EMPTY,
+                          memory_order_relaxed);
+    return min;
+}
+
+//Push item with priority key (smaller comes out first) onto a random
+//heap. rng is the calling thread's own. Returns 0 if memory ran out.
+int dsp_mq_push(dsp_multiqueue_t *mq, uint64_t key, void *item, dsp_rng_t *rng)
+{
+    dsp_pq_t *q = &mq->queues[dsp_rng_below(rng, mq->active)];
+    int ok;
+
+    pthread_mutex_lock(&q->lock);
+    ok = pq_push(q, key, item);
+    pthread_mutex_unlock(&q->lock);
+    return ok;
+}
+
+//Take from q if it still has anything. Returns 1 if it did.
+static int mq_take(dsp_pq_t *q, uint64_t *key, void **item)
+{
+    dsp_pq_entry e;
+
+    pthread_mutex_lock(&q->lock);
+    if(q->count == 0){
+        pthread_mutex_unlock(&q->lock);
+        return 0;
+    }
+    e = pq_pop(q);
+    pthread_mutex_unlock(&q->lock);
+    *key = e.key;
+    *item = e.item;
+    return 1;
+}
+
+//Pop a small keyed item: the better top of two random heaps. If both are
+//empty, every heap is tried in turn from a random one, so 0 is returned
+//only when the whole queue looked empty.
+int dsp_mq_pop(dsp_multiqueue_t *mq, uint64_t *key, void **item, dsp_rng_t *rng)
+{
+    dsp_pq_t *a, *b;
+    int i, r;
+
+    a = &mq->queues[dsp_rng_below(rng, mq->active)];
+    b = &mq->queues[dsp_rng_below(rng, mq->active)];
+    if(atomic_load_explicit(&b->top, memory_order_relaxed) <
+       atomic_load_explicit(&a->top, memory_order_relaxed)){
+        a = b;
+    }
+    if(atomic_load_explicit(&a->top, memory_order_relaxed) != DSP_PQ_EMPTY &&
+       mq_take(a, key, item))
+        return 1;
+
+    r = dsp_rng_below(rng, mq->active);
+    for(i = 0; i < mq->active; i++){
+        a = &mq->queues[(i + r) % mq->active];
+        if(atomic_load_explicit(&a->top, memory_order_relaxed) != DSP_PQ_EMPTY &&
+           mq_take(a, key, item))
+            return 1;
+    }
+    return 0;
+}
+
+//Only a snapshot when other threads are active.
+int dsp_mq_isempty(dsp_multiqueue_t *mq)
+{
+    int i;
+
+    for(i = 0; i < mq->active; i++){
+        if(atomic_load_explicit(&mq->queues[i].top, memory_order_relaxed) != DSP_PQ_EMPTY)
+            return 0;
+    }
+    return 1;
+}
@@ -0,0 +1,47 @@
+//Written by David Ells
+//
+//A relaxed concurrent priority queue (a MultiQueue, Rihani, Sanders and
+//Dementiev, SPAA 2015). It is a set of binary min-heaps, each with its
+//own lock. A push goes to a random heap. A pop looks at the tops of two
+//random heaps and takes the smaller, so the item returned is only close
+//to the smallest, but threads rarely contend for a lock.
+
+#ifndef PQUEUE_H
+#define PQUEUE_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include "deque.h"
+#include "rng.h"
+
+//Keys must be less than this, which marks an empty heap.
+#define DSP_PQ_EMPTY UINT64_MAX
+
+typedef struct {
+    uint64_t key;
+    void *item;
+} dsp_pq_entry;
+
+typedef struct {
+    _Alignas(DSP_CACHELINE) pthread_mutex_t lock;
+    atomic_ullong top;          //smallest key, read without the lock
+    dsp_pq_entry *heap;
+    long count;
+    long size;
+} dsp_pq_t;
+
+typedef struct {
+    int num_queues;             //heaps allocated
+    int active;                 //heaps in use, see dsp_mq_reset
+    dsp_pq_t *queues;
+} dsp_multiqueue_t;
+
+dsp_multiqueue_t *dsp_mq_create(int);
+void dsp_mq_reset(dsp_multiqueue_t *, int);
+void dsp_mq_destroy(dsp_multiqueue_t *);
+int dsp_mq_push(dsp_multiqueue_t *, uint64_t, void *, dsp_rng_t *);
+int dsp_mq_pop(dsp_multiqueue_t *, uint64_t *, void **, dsp_rng_t *);
+int dsp_mq_isempty(dsp_multiqueue_t *);
+
+#endif
@@ -1,5 +1,11 @@
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#include "intfile.h"
+
+#define RANDINTS_BUF_LEN 4096
 
 int randint(int max)
 {
@@ -8,18 +14,43 @@ int randint(int max)
 
 int main(int argc, char *argv[])
 {
-    int randseed, num_ints, i;
+    int randseed, num_ints, i, n;
+    int binary = 0;
+    int buf[RANDINTS_BUF_LEN];
 
+    if(argc == 4 && strcmp(argv[1], "--binary") == 0){
+        binary = 1;
+        argv++;
+        argc--;
+    }
     if(argc != 3){
-        printf("usage: randint [rand seed] [number of ints]\n");
+        printf("usage: randint [--binary] [rand seed] [number of ints]\n");
         exit(1);
     }
     randseed = atoi(argv[1]);
     num_ints = atoi(argv[2]);
 
     srand(randseed);
-    for(i = 0; i < num_ints; i++){
-        printf("%d\n", randint(num_ints));
+    if(!binary){
+        for(i = 0; i < num_ints; i++){
+            printf("%d\n", randint(num_ints));
+        }
+        return 0;
+    }
+
+    //Same values as the text output, written as a binary .i32 file.
+    if(intfile_write_header(stdout, num_ints) != 0){
+        perror("randints: error writing header");
+        exit(1);
+    }
+    for(i = 0; i < num_ints; i += n){
+        for(n = 0; n < RANDINTS_BUF_LEN && i + n < num_ints; n++){
+            buf[n] = randint(num_ints);
+        }
+        if(intfile_write_ints(stdout, buf, n) != 0){
+            perror("randints: error writing values");
+            exit(1);
+        }
     }
 
     return 0;
@@ -0,0 +1,215 @@
+//Written by David Ells
+//
+//Parallel reductions over a pointer tree. See reduce.h.
+
+#include <limits.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include "reduce.h"
+#include "deque.h"
+#include "rng.h"
+
+typedef struct {
+    const tree_reducer *r;
+    int num_threads;
+    dsp_deque_t **deques;
+    char *partials;         //one partial result per thread
+    size_t stride;          //bytes between partials, whole cache lines
+    atomic_int idle;        //threads with no work
+} reduce_job;
+
+static void reduce_worker(int, void *);
+static treenode *reduce_steal(reduce_job *, int, dsp_rng_t *);
+
+//Reduce every node of t with r, using num_threads of pool's threads (or
+//just the calling one if pool is NULL), into result, which must have room
+//for r->size bytes. Returns 0 if there was no memory for the work.
+int tree_reduce(tree *t, dsp_pool_t *pool, int num_threads, const tree_reducer *r,
+                void *result)
+{
+    reduce_job job;
+    int i, ok = 1;
+
+    if(pool == NULL || num_threads < 1) num_threads = 1;
+    job.r = r;
+    job.num_threads = num_threads;
+    job.stride = (r->size + DSP_CACHELINE - 1) / DSP_CACHELINE * DSP_CACHELINE;
+    if(job.stride == 0) job.stride = DSP_CACHELINE;
+    atomic_init(&job.idle, 0);
+
+    job.deques = (dsp_deque_t **)calloc(num_threads, sizeof(dsp_deque_t *));
+    if(job.deques == NULL) return 0;
+    if(posix_memalign((void **)&job.partials, DSP_CACHELINE, job.stride * num_threads) != 0){
+        free(job.deques);
+        return 0;
+    }
+    for(i = 0; i < num_threads && ok; i++){
+        job.deques[i] = dsp_deque_create(0);
+        if(job.deques[i] == NULL) ok = 0;
+    }
+
+    if(ok){
+        //Everyone else starts by stealing from the first thread.
+        if(t->head != NULL) dsp_deque_push(job.deques[0], t->head);
+        if(num_threads == 1)
+            reduce_worker(0, &job);
+        else
+            dsp_pool_run(pool, num_threads, reduce_worker, &job);
+
+        r->init(result, r->arg);
+        for(i = 0; i < num_threads; i++){
+            r->combine(result, job.partials + job.stride * i, r->arg);
+        }
+    }
+
+    for(i = 0; i < num_threads; i++){
+        if(job.deques[i] != NULL) dsp_deque_destroy(job.deques[i]);
+    }
+    free(job.deques);
+    free(job.partials);
+    return ok;
+}
+
+//Go depth first from whatever is on my deque, pushing right children and
+//following left ones, then steal until there is nothing left anywhere.
+static void reduce_worker(int id, void *arg)
+{
+    reduce_job *job = (reduce_job *)arg;
+    const tree_reducer *r = job->r;
+    dsp_deque_t *q = job->deques[id];
+    void *acc = job->partials + job->stride * id;
+    dsp_rng_t rng;
+    treenode *n;
+
+    r->init(acc, r->arg);
+    dsp_rng_seed(&rng, id, 0);
+    while(1){
+        n = (treenode *)dsp_deque_pop(q);
+        if(n == NULL) n = reduce_steal(job, id, &rng);
+        if(n == NULL) break;
+
+        for(; n != NULL; n = n->left){
+            r->accumulate(acc, n, r->arg);
+            if(n->right != NULL) dsp_deque_push(q, n->right);
+        }
+    }
+}
+
+//Steal a node, starting from a random victim. A thread counts itself idle
+//while it holds no work, so once every thread is idle there is none left.
+//Returns NULL then.
+static treenode *reduce_steal(reduce_job *job, int id, dsp_rng_t *rng)
+{
+    int i, j, first;
+    void *n;
+
+    atomic_fetch_add(&job->idle, 1);
+    while(atomic_load(&job->idle) < job->num_threads){
+        first = dsp_rng_below(rng, job->num_threads);
+        for(i = 0; i < job->num_threads; i++){
+            j = (first + i) % job->num_threads;
+            if(j == id || dsp_deque_isempty(job->deques[j])) continue;
+
+            atomic_fetch_sub(&job->idle, 1);
+            n = dsp_deque_steal(job->deques[j]);
+            if(n != NULL && n != DSP_DEQUE_ABORT) return (treenode *)n;
+            atomic_fetch_add(&job->idle, 1);
+        }
+        sched_yield();
+    }
+    return NULL;
+}
+
+
+//------ Count, sum, min and max ------
+
+static void summary_init(void *acc, void *arg)
+{
+    tree_summary *s = (tree_summary *)acc;
+
+    s->count = 0;
+    s->sum = 0;
+    s->min = INT_MAX;
+    s->max = INT_MIN;
+}
+
+static void summary_accumulate(void *acc, treenode *n, void *arg)
+{
+    tree_summary *s = (tree_summary *)acc;
+    int v;
+
+    if(n->data == NULL) return;
+    v = *((int *)n->data);
+    s->count++;
+    s->sum += v;
+    if(v < s->min) s->min = v;
+    if(v > s->max) s->max = v;
+}
+
+static void summary_combine(void *acc, const void *other, void *arg)
+{
+    tree_summary *s = (tree_summary *)acc;
+    const tree_summary *o = (const tree_summary *)other;
+
+    s->count += o->count;
+    s->sum += o->sum;
+    if(o->min < s->min) s->min = o->min;
+    if(o->max > s->max) s->max = o->max;
+}
+
+const tree_reducer tree_summary_reducer = {
+    sizeof(tree_summary), summary_init, summary_accumulate, summary_combine, NULL
+};
+
+
+//------ Histogram ------
+
+static void histogram_init(void *acc, void *arg)
+{
+    tree_histogram *h = (tree_histogram *)arg;
+
+    memset(acc, 0, sizeof(long) * h->bins);
+}
+
+static void histogram_accumulate(void *acc, treenode *n, void *arg)
+{
+    tree_histogram *h = (tree_histogram *)arg;
+    long long b;
+
+    if(n->data == NULL) return;
+    b = ((long long)*((int *)n->data) - h->lo) * h->bins / ((long long)h->hi - h->lo + 1);
+    if(b < 0) b = 0;
+    if(b >= h->bins) b = h->bins - 1;
+    ((long *)acc)[b]++;
+}
+
+static void histogram_combine(void *acc, const void *other, void *arg)
+{
+    tree_histogram *h = (tree_histogram *)arg;
+    int i;
+
+    for(i = 0; i < h->bins; i++){
+        ((long *)acc)[i] += ((const long *)other)[i];
+    }
+}
+
+//Set r up to count values into h's bins. h must have lo <= hi and at
+//least one bin, and must outlive r.
+void tree_histogram_reducer(tree_reducer *r, tree_histogram *h)
+{
+    r->size = sizeof(long) * h->bins;
+    r->init = histogram_init;
+    r->accumulate = histogram_accumulate;
+    r->combine = histogram_combine;
+    r->arg = h;
+}
+
+//Smallest value that goes in bin b, ignoring the clamping at the ends.
+long long tree_histogram_start(tree_histogram *h, int b)
+{
+    long long span = (long long)h->hi - h->lo + 1;
+
+    return h->lo + (span * b + h->bins - 1) / h->bins;
+}
@@ -0,0 +1,51 @@
+//Written by David Ells
+//
+//Parallel reductions over a pointer tree, run on a pool of worker threads.
+//Each thread goes depth first with a work stealing deque of its own, as
+//the search does, and folds every node it visits into a partial result of
+//its own. The partials are combined once all threads are done, so the
+//reducer's combine must be associative and commutative for the result
+//not to depend on which thread visited what.
+
+#ifndef REDUCE_H
+#define REDUCE_H
+
+#include <stddef.h>
+#include "tree.h"
+#include "pool.h"
+
+//A reduction: init makes an empty partial result of size bytes,
+//accumulate folds one node into a partial, and combine folds the second
+//partial into the first. arg is passed to all three.
+typedef struct {
+    size_t size;
+    void (*init)(void *, void *);
+    void (*accumulate)(void *, treenode *, void *);
+    void (*combine)(void *, const void *, void *);
+    void *arg;
+} tree_reducer;
+
+//Result of tree_summary_reducer, over the nodes holding a value.
+typedef struct {
+    long count;
+    long long sum;
+    int min;            //INT_MAX when count is 0
+    int max;            //INT_MIN when count is 0
+} tree_summary;
+
+//Histogram bins. The values from lo to hi are split into bins bins of
+//equal width, bin b starting at tree_histogram_start(h, b); values outside
+//go in the first or last bin. The result is an array of bins counts.
+typedef struct {
+    int lo;
+    int hi;
+    int bins;
+} tree_histogram;
+
+extern const tree_reducer tree_summary_reducer;
+
+void tree_histogram_reducer(tree_reducer *, tree_histogram *);
+long long tree_histogram_start(tree_histogram *, int);
+int tree_reduce(tree *, dsp_pool_t *, int, const tree_reducer *, void *);
+
+#endif
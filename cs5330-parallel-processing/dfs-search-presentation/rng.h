@@ -0,0 +1,93 @@
+//Written by David Ells
+//
+//Pseudo random numbers with a separate state per user, for code that runs
+//in several threads at once and must not share rand()'s hidden state.
+//Streams are xoshiro256** (Blackman & Vigna), seeded with splitmix64.
+//Stream k of a seed starts k jumps of 2^128 steps into the sequence, so
+//streams never overlap in practice.
+
+#ifndef RNG_H
+#define RNG_H
+
+#include <stdint.h>
+
+typedef struct {
+    uint64_t s[4];
+} dsp_rng_t;
+
+static inline uint64_t dsp_splitmix64(uint64_t *x)
+{
+    uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static inline uint64_t dsp_rng_rotl(uint64_t x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+static inline uint64_t dsp_rng_next(dsp_rng_t *r)
+{
+    uint64_t *s = r->s;
+    uint64_t result = dsp_rng_rotl(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = dsp_rng_rotl(s[3], 45);
+    return result;
+}
+
+//Advance r by 2^128 steps.
+static inline void dsp_rng_jump(dsp_rng_t *r)
+{
+    static const uint64_t jump[4] = {
+        0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL,
+        0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL
+    };
+    uint64_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    int i, b;
+
+    for(i = 0; i < 4; i++){
+        for(b = 0; b < 64; b++){
+            if(jump[i] & ((uint64_t)1 << b)){
+                s0 ^= r->s[0];
+                s1 ^= r->s[1];
+                s2 ^= r->s[2];
+                s3 ^= r->s[3];
+            }
+            dsp_rng_next(r);
+        }
+    }
+    r->s[0] = s0;
+    r->s[1] = s1;
+    r->s[2] = s2;
+    r->s[3] = s3;
+}
+
+static inline void dsp_rng_seed(dsp_rng_t *r, uint64_t seed, unsigned long stream)
+{
+    uint64_t x = seed;
+    unsigned long k;
+
+    r->s[0] = dsp_splitmix64(&x);
+    r->s[1] = dsp_splitmix64(&x);
+    r->s[2] = dsp_splitmix64(&x);
+    r->s[3] = dsp_splitmix64(&x);
+    for(k = 0; k < stream; k++) dsp_rng_jump(r);
+}
+
+//Uniform in [0, n), by multiply and shift (Lemire). The bias is at most
+//n / 2^64, far below anything the callers can notice.
+static inline uint64_t dsp_rng_below(dsp_rng_t *r, uint64_t n)
+{
+    return (uint64_t)(((unsigned __int128)dsp_rng_next(r) * n) >> 64);
+}
+
+#endif
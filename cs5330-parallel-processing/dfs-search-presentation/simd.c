@@ -0,0 +1,170 @@
+//Written by David Ells
+//
+//Vectorized linear scan for a value in an int array. See simd.h.
+
+#include <string.h>
+#include "simd.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define DSP_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+static long scan_dispatch(const int *, long, int);
+
+dsp_scan_func dsp_scan_eq = scan_dispatch;
+static const char *scan_name = "scalar";
+
+long dsp_scan_eq_scalar(const int *vals, long n, int key)
+{
+    long i;
+
+    for(i = 0; i < n; i++){
+        if(vals[i] == key) return i;
+    }
+    return -1;
+}
+
+#ifdef DSP_SIMD_X86
+
+//Four ints per compare. Only SSE2 instructions are needed, but the kernel
+//is offered on SSE4.1 machines, the baseline we tune for.
+__attribute__((target("sse4.1")))
+static long scan_eq_sse4(const int *vals, long n, int key)
+{
+    __m128i k = _mm_set1_epi32(key);
+    __m128i a, b;
+    int mask;
+    long i = 0;
+
+    for(; i + 8 <= n; i += 8){
+        a = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *)(vals + i)), k);
+        b = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *)(vals + i + 4)), k);
+        mask = _mm_movemask_ps(_mm_castsi128_ps(a)) |
+               (_mm_movemask_ps(_mm_castsi128_ps(b)) << 4);
+        if(mask) return i + __builtin_ctz(mask);
+    }
+    for(; i < n; i++){
+        if(vals[i] == key) return i;
+    }
+    return -1;
+}
+
+//Eight ints per compare, four compares per branch.
+__attribute__((target("avx2")))
+static long scan_eq_avx2(const int *vals, long n, int key)
+{
+    __m256i k = _mm256_set1_epi32(key);
+    __m256i a, b, c, d;
+    int mask;
+    long i = 0;
+
+    for(; i + 32 <= n; i += 32){
+        a = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i *)(vals + i)), k);
+        b = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i *)(vals + i + 8)), k);
+        c = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i *)(vals + i + 16)), k);
+        d = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i *)(vals + i + 24)), k);
+        if(!_mm256_testz_si256(_mm256_or_si256(_mm256_or_si256(a, b),
+                                               _mm256_or_si256(c, d)),
+                               _mm256_set1_epi32(-1))){
+            break;
+        }
+    }
+    for(; i + 8 <= n; i += 8){
+        a = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i *)(vals + i)), k);
+        mask = _mm256_movemask_ps(_mm256_castsi256_ps(a));
+        if(mask) return i + __builtin_ctz(mask);
+    }
+    for(; i < n; i++){
+        if(vals[i] == key) return i;
+    }
+    return -1;
+}
+
+//Sixteen ints per compare, four compares per branch. The tail is done
+//with a masked load, so there is no scalar loop.
+__attribute__((target("avx512f")))
+static long scan_eq_avx512(const int *vals, long n, int key)
+{
+    __m512i k = _mm512_set1_epi32(key);
+    __mmask16 a, b, c, d, tail;
+    long i = 0;
+
+    for(; i + 64 <= n; i += 64){
+        a = _mm512_cmpeq_epi32_mask(_mm512_loadu_si512((const void *)(vals + i)), k);
+        b = _mm512_cmpeq_epi32_mask(_mm512_loadu_si512((const void *)(vals + i + 16)), k);
+        c = _mm512_cmpeq_epi32_mask(_mm512_loadu_si512((const void *)(vals + i + 32)), k);
+        d = _mm512_cmpeq_epi32_mask(_mm512_loadu_si512((const void *)(vals + i + 48)), k);
+        if(a | b | c | d){
+            if(a) return i + __builtin_ctz(a);
+            if(b) return i + 16 + __builtin_ctz(b);
+            if(c) return i + 32 + __builtin_ctz(c);
+            return i + 48 + __builtin_ctz(d);
+        }
+    }
+    for(; i < n; i += 16){
+        tail = (n - i >= 16) ? 0xffff : (__mmask16)((1u << (n - i)) - 1);
+        a = _mm512_mask_cmpeq_epi32_mask(tail, _mm512_maskz_loadu_epi32(tail, vals + i), k);
+        if(a) return i + __builtin_ctz(a);
+    }
+    return -1;
+}
+
+#endif
+
+typedef struct {
+    const char *name;
+    dsp_scan_func func;
+    int supported;
+} scan_kernel;
+
+//Pick a scan kernel: the named one ("scalar", "sse4", "avx2", "avx512"),
+//else the best one the processor supports. Returns 0 if the named kernel
+//is unknown or unsupported, in which case the best one is used instead.
+//Call before starting threads that scan.
+int dsp_simd_init(const char *name)
+{
+    scan_kernel kernels[4];
+    int i, num_kernels = 0, best = 0;
+
+    kernels[num_kernels].name = "scalar";
+    kernels[num_kernels].func = dsp_scan_eq_scalar;
+    kernels[num_kernels++].supported = 1;
+#ifdef DSP_SIMD_X86
+    __builtin_cpu_init();
+    kernels[num_kernels].name = "sse4";
+    kernels[num_kernels].func = scan_eq_sse4;
+    kernels[num_kernels++].supported = __builtin_cpu_supports("sse4.1");
+    kernels[num_kernels].name = "avx2";
+    kernels[num_kernels].func = scan_eq_avx2;
+    kernels[num_kernels++].supported = __builtin_cpu_supports("avx2");
+    kernels[num_kernels].name = "avx512";
+    kernels[num_kernels].func = scan_eq_avx512;
+    kernels[num_kernels++].supported = __builtin_cpu_supports("avx512f");
+#endif
+
+    for(i = 0; i < num_kernels; i++){
+        if(kernels[i].supported) best = i;
+    }
+    for(i = 0; name != NULL && i < num_kernels; i++){
+        if(strcmp(name, kernels[i].name) == 0 && kernels[i].supported){
+            best = i;
+            break;
+        }
+    }
+    dsp_scan_eq = kernels[best].func;
+    scan_name = kernels[best].name;
+    return (name == NULL || i < num_kernels);
+}
+
+const char *dsp_simd_name()
+{
+    return scan_name;
+}
+
+//First call through dsp_scan_eq picks the best kernel.
+static long scan_dispatch(const int *vals, long n, int key)
+{
+    dsp_simd_init(NULL);
+    return dsp_scan_eq(vals, n, key);
+}
@@ -0,0 +1,19 @@
+//Written by David Ells
+//
+//Vectorized linear scan for a value in an int array. The kernel is picked
+//at run time from what the processor supports (AVX-512, AVX2, then
+//SSE4.1), with a plain scalar loop as the fallback everywhere else.
+
+#ifndef SIMD_H
+#define SIMD_H
+
+typedef long (*dsp_scan_func)(const int *, long, int);
+
+//Index of the first element of vals[0..n) equal to key, or -1.
+extern dsp_scan_func dsp_scan_eq;
+
+int dsp_simd_init(const char *);
+const char *dsp_simd_name();
+long dsp_scan_eq_scalar(const int *, long, int);
+
+#endif
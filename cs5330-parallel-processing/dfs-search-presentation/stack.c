@@ -1,78 +1,109 @@
 //Written by David Ells
 //
-//Simple stack datatype implemented using kazlib's list datatype.
+//Simple stack datatype implemented as a growable ring buffer of pointers.
 
 #include "stack.h"
 
-void dsp_stack_init(dsp_stack_t *s, listcount_t max)
-{
-    /*if(s->list == NULL)
-        s->list = list_create(max);*/
+#define DSP_STACK_MIN_SIZE 64
 
-    list_init(s->list, max);
+//Initialize an unused stack. Its buffer starts small and doubles as
+//needed, up to max entries (or without limit if max is 0).
+void dsp_stack_init(dsp_stack_t *s, unsigned long max)
+{
+    s->buf = (void **)malloc(sizeof(void *) * DSP_STACK_MIN_SIZE);
+    s->first = 0;
+    s->count = 0;
+    s->size = (s->buf == NULL) ? 0 : DSP_STACK_MIN_SIZE;
+    s->max = max;
 }
 
-dsp_stack_t *dsp_stack_create(listcount_t max)
+dsp_stack_t *dsp_stack_create(unsigned long max)
 {
     dsp_stack_t *s = (dsp_stack_t*)malloc(sizeof(dsp_stack_t));
     if(s == NULL) return NULL;
 
-    s->list = list_create(max);
+    dsp_stack_init(s, max);
+    if(s->buf == NULL){
+        free(s);
+        return NULL;
+    }
     return s;
 }
 
 void dsp_stack_destroy(dsp_stack_t *s)
 {
-    list_destroy(s->list);
+    free(s->buf);
     free(s);
 }
 
+//Drop all entries, keeping the buffer for reuse.
+void dsp_stack_destroy_nodes(dsp_stack_t *s)
+{
+    s->first = 0;
+    s->count = 0;
+}
+
+//Double the buffer, unwrapping the entries to the front of the new one.
+static int dsp_stack_grow(dsp_stack_t *s)
+{
+    void **nbuf;
+    unsigned long i, nsize;
+
+    nsize = (s->size == 0) ? DSP_STACK_MIN_SIZE : s->size * 2;
+    nbuf = (void **)malloc(sizeof(void *) * nsize);
+    if(nbuf == NULL) return 0;
+
+    for(i = 0; i < s->count; i++){
+        nbuf[i] = s->buf[(s->first + i) & (s->size - 1)];
+    }
+    free(s->buf);
+    s->buf = nbuf;
+    s->first = 0;
+    s->size = nsize;
+    return 1;
+}
+
 
 int dsp_stack_push(dsp_stack_t *s, void *data)
 {
-    lnode_t *n = lnode_create(data);
-    if(n == NULL) return 0;
-    list_append(s->list, n);
+    if(s->max != 0 && s->count >= s->max) return 0;
+    if(s->count == s->size && !dsp_stack_grow(s)) return 0;
+
+    s->buf[(s->first + s->count) & (s->size - 1)] = data;
+    s->count++;
     return 1;
 }
 
 void *dsp_stack_pop(dsp_stack_t *s)
 {
-    lnode_t *n;
-
     if(dsp_stack_isempty(s)) return NULL;
-    n = list_del_last(s->list);
-    if(n == NULL) return NULL;
-    return n->list_data;
+    s->count--;
+    return s->buf[(s->first + s->count) & (s->size - 1)];
 }
 
 void *dsp_stack_top(dsp_stack_t *s)
 {
-    lnode_t *n;
-
     if(dsp_stack_isempty(s)) return NULL;
-    n = list_last(s->list);
-    if(n == NULL) return NULL;
-    return n->list_data;
+    return s->buf[(s->first + s->count - 1) & (s->size - 1)];
 }
 
 void *dsp_stack_del_first(dsp_stack_t *s)
 {
-    lnode_t *n;
-    
+    void *data;
+
     if(dsp_stack_isempty(s)) return NULL;
-    n = list_del_first(s->list);
-    if(n == NULL) return NULL;
-    return n->list_data;
+    data = s->buf[s->first];
+    s->first = (s->first + 1) & (s->size - 1);
+    s->count--;
+    return data;
 }
-    
+
 int dsp_stack_size(dsp_stack_t *s)
 {
-    return list_count(s->list);
+    return s->count;
 }
 
 int dsp_stack_isempty(dsp_stack_t *s)
 {
-    return (dsp_stack_size(s) == 0);
+    return (s->count == 0);
 }
-
@@ -1,17 +1,23 @@
 //Written by David Ells
 //
-//Simple stack datatype implemented using kazlib's list datatype.
+//Simple stack datatype implemented as a growable ring buffer of pointers.
+//Entries are pushed and popped at the top, and dsp_stack_del_first takes
+//the oldest entry from the bottom, so pushes and pops never allocate
+//except when the buffer has to double.
 
 #include <stdio.h>
 #include <stdlib.h>
-#include "list.h"
 
 typedef struct {
-    list_t *list;
+    void **buf;
+    unsigned long first;    //index in buf of the oldest entry
+    unsigned long count;
+    unsigned long size;     //capacity of buf, always a power of two
+    unsigned long max;      //most entries allowed, 0 for no limit
 } dsp_stack_t;
 
-void dsp_stack_init(dsp_stack_t *, listcount_t);
-dsp_stack_t *dsp_stack_create(listcount_t);
+void dsp_stack_init(dsp_stack_t *, unsigned long);
+dsp_stack_t *dsp_stack_create(unsigned long);
 void dsp_stack_destroy(dsp_stack_t *);
 void dsp_stack_destroy_nodes(dsp_stack_t *);
 
@@ -21,4 +27,3 @@ void *dsp_stack_top(dsp_stack_t *);
 void *dsp_stack_del_first(dsp_stack_t *);
 int dsp_stack_size(dsp_stack_t *);
 int dsp_stack_isempty(dsp_stack_t *);
-
@@ -0,0 +1,147 @@
+/* Written by David Ells
+ *
+ * Benchmark of the ring buffer dsp_stack_t against the kazlib list backed
+ * stack it replaced. Each thread works its own stack with the same pattern
+ * the DFS search uses (push right children going down, pop them back, and
+ * occasionally lose the oldest entry to a thief), so the list version pays
+ * one malloc/free per push from every thread at once. */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include "stack.h"
+#include "list.h"
+
+#define PROGNAME "stackbench"
+#define STACKBENCH_THREAD_MAX 128
+#define STACKBENCH_DEPTH 48
+
+typedef struct {
+    int id;
+    long ops;
+    long checksum;
+} stackbench_args;
+
+//The list backed stack, as stack.c implemented it before the ring buffer.
+//Popped nodes are freed here, which the old version forgot to do.
+int list_stack_push(list_t *l, void *data)
+{
+    lnode_t *n = lnode_create(data);
+    if(n == NULL) return 0;
+    list_append(l, n);
+    return 1;
+}
+
+void *list_stack_pop(list_t *l)
+{
+    lnode_t *n;
+    void *data;
+
+    if(list_isempty(l)) return NULL;
+    n = list_del_last(l);
+    data = n->list_data;
+    lnode_destroy(n);
+    return data;
+}
+
+void *list_stack_del_first(list_t *l)
+{
+    lnode_t *n;
+    void *data;
+
+    if(list_isempty(l)) return NULL;
+    n = list_del_first(l);
+    data = n->list_data;
+    lnode_destroy(n);
+    return data;
+}
+
+void *thread_bench_ring(void *args)
+{
+    stackbench_args *a = (stackbench_args *)args;
+    dsp_stack_t *s = dsp_stack_create(0);
+    long i, done = 0;
+
+    while(done < a->ops){
+        for(i = 1; i <= STACKBENCH_DEPTH; i++){
+            dsp_stack_push(s, (void *)i);
+        }
+        a->checksum += (long)dsp_stack_del_first(s);
+        while(!dsp_stack_isempty(s)){
+            a->checksum += (long)dsp_stack_pop(s);
+        }
+        done += STACKBENCH_DEPTH * 2;
+    }
+    dsp_stack_destroy(s);
+    return NULL;
+}
+
+void *thread_bench_list(void *args)
+{
+    stackbench_args *a = (stackbench_args *)args;
+    list_t *l = list_create(LISTCOUNT_T_MAX);
+    long i, done = 0;
+
+    while(done < a->ops){
+        for(i = 1; i <= STACKBENCH_DEPTH; i++){
+            list_stack_push(l, (void *)i);
+        }
+        a->checksum += (long)list_stack_del_first(l);
+        while(!list_isempty(l)){
+            a->checksum += (long)list_stack_pop(l);
+        }
+        done += STACKBENCH_DEPTH * 2;
+    }
+    list_destroy(l);
+    return NULL;
+}
+
+void run_bench(const char *name, void *(*func)(void *), int num_threads, long ops)
+{
+    int i;
+    pthread_t threads[STACKBENCH_THREAD_MAX];
+    stackbench_args args[STACKBENCH_THREAD_MAX];
+    float bench_time;
+    struct timeval t0, t1;
+
+    gettimeofday(&t0, NULL);
+    for(i = 0; i < num_threads; i++){
+        args[i].id = i;
+        args[i].ops = ops;
+        args[i].checksum = 0;
+        pthread_create(&threads[i], NULL, func, &args[i]);
+    }
+    for(i = 0; i < num_threads; i++){
+        pthread_join(threads[i], NULL);
+    }
+    gettimeofday(&t1, NULL);
+    bench_time = (float)(t1.tv_sec - t0.tv_sec) + ((float)(t1.tv_usec - t0.tv_usec)/1000000.0);
+
+    //impl	threads	ops/thread	time	Mops/s
+    printf("%s\t\t%d\t\t%ld\t\t%f\t\t%.2f\n", name, num_threads, ops, bench_time,
+           (num_threads * (double)ops) / bench_time / 1000000.0);
+}
+
+int main(int argc, char *argv[])
+{
+    int num_threads;
+    long ops;
+
+    if(argc != 3){
+        printf("usage: " PROGNAME " [number of threads] [ops per thread]\n");
+        exit(1);
+    }
+    num_threads = atoi(argv[1]);
+    ops = atol(argv[2]);
+    if(num_threads < 1 || num_threads > STACKBENCH_THREAD_MAX || ops < 1){
+        printf(PROGNAME ": error: threads must be 1 to %d and ops positive\n",
+               STACKBENCH_THREAD_MAX);
+        exit(1);
+    }
+
+    run_bench("list", thread_bench_list, num_threads, ops);
+    run_bench("ring", thread_bench_ring, num_threads, ops);
+    return 0;
+}
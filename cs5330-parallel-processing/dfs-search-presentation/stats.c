@@ -0,0 +1,145 @@
+//Written by David Ells
+//
+//Per thread search counters for dfs-search. See stats.h.
+
+#include <stdlib.h>
+#include <string.h>
+#include "stats.h"
+
+//Allocate counters for num_threads threads, cache line aligned. Returns
+//NULL on failure.
+dfs_thread_stats *dfs_stats_create(int num_threads)
+{
+    dfs_thread_stats *s;
+
+    if(posix_memalign((void **)&s, DSP_CACHELINE,
+                      sizeof(dfs_thread_stats) * num_threads) != 0)
+        return NULL;
+    dfs_stats_reset(s, num_threads);
+    return s;
+}
+
+void dfs_stats_reset(dfs_thread_stats *s, int num_threads)
+{
+    memset(s, 0, sizeof(dfs_thread_stats) * num_threads);
+}
+
+//Add up the counters of num_threads threads into total. Times are summed
+//too, except run_time and cancel_time, which are the longest.
+void dfs_stats_sum(dfs_thread_stats *total, dfs_thread_stats *s, int num_threads)
+{
+    int i;
+
+    dfs_stats_reset(total, 1);
+    for(i = 0; i < num_threads; i++){
+        total->nodes += s[i].nodes;
+        total->pushes += s[i].pushes;
+        total->pops += s[i].pops;
+        total->publishes += s[i].publishes;
+        total->nodes_published += s[i].nodes_published;
+        total->steal_attempts += s[i].steal_attempts;
+        total->steals += s[i].steals;
+        total->remote_steals += s[i].remote_steals;
+        total->nodes_stolen += s[i].nodes_stolen;
+        total->steal_time += s[i].steal_time;
+        total->idle_time += s[i].idle_time;
+        if(s[i].run_time > total->run_time) total->run_time = s[i].run_time;
+        if(s[i].cancel_time > total->cancel_time) total->cancel_time = s[i].cancel_time;
+    }
+}
+
+//Split the time from start to end of one search into phases, given when
+//the workers were woken (0 if they never were) and the stamps they left.
+void dfs_stats_phases(dfs_search_phases *p, dfs_thread_stats *s, int num_threads,
+                      double start, double wake, double end)
+{
+    double last_start = 0.0, last_stop = 0.0;
+    int i;
+
+    memset(p, 0, sizeof(dfs_search_phases));
+    if(wake == 0.0){
+        p->setup = end - start;
+        return;
+    }
+    for(i = 0; i < num_threads; i++){
+        if(s[i].start_stamp == 0.0) continue;
+        if(s[i].start_stamp > last_start) last_start = s[i].start_stamp;
+        if(s[i].stop_stamp > last_stop) last_stop = s[i].stop_stamp;
+    }
+    if(last_start == 0.0){
+        last_start = wake;
+        last_stop = wake;
+    }
+    p->setup = wake - start;
+    p->wake = last_start - wake;
+    p->search = last_stop - last_start;
+    p->join = end - last_stop;
+}
+
+static void print_text_line(FILE *f, const char *name, dfs_thread_stats *s)
+{
+    fprintf(f, "%-8s %12ld %10ld %10ld %8ld %10ld %10ld %8ld %8ld %10ld %10.6f %10.6f %10.6f %10.6f\n",
+            name, s->nodes, s->pushes, s->pops, s->publishes, s->nodes_published,
+            s->steal_attempts, s->steals,
+            s->remote_steals, s->nodes_stolen, s->steal_time, s->idle_time, s->run_time,
+            s->cancel_time);
+}
+
+//One line of counters per thread, then the totals and the phases.
+void dfs_stats_print_text(FILE *f, dfs_search_summary *sum,
+                          dfs_thread_stats *s, int num_threads)
+{
+    dfs_thread_stats total;
+    char name[16];
+    int i;
+
+    fprintf(f, "%-8s %12s %10s %10s %8s %10s %10s %8s %8s %10s %10s %10s %10s %10s\n",
+            "thread", "nodes", "pushes", "pops", "publish", "published", "attempts", "steals",
+            "remote", "stolen", "steal_s", "idle_s", "run_s", "cancel_s");
+    for(i = 0; i < num_threads; i++){
+        snprintf(name, sizeof(name), "%d", i);
+        print_text_line(f, name, &s[i]);
+    }
+    dfs_stats_sum(&total, s, num_threads);
+    print_text_line(f, "total", &total);
+    fprintf(f, "phases   setup %.9f wake %.9f search %.9f join %.9f\n",
+            sum->phases.setup, sum->phases.wake, sum->phases.search, sum->phases.join);
+}
+
+static void print_json_counters(FILE *f, dfs_thread_stats *s)
+{
+    fprintf(f, "\"nodes\":%ld,\"pushes\":%ld,\"pops\":%ld,"
+               "\"publishes\":%ld,\"nodes_published\":%ld,"
+               "\"steal_attempts\":%ld,\"steals\":%ld,\"remote_steals\":%ld,"
+               "\"nodes_stolen\":%ld,"
+               "\"steal_time\":%.9f,\"idle_time\":%.9f,\"run_time\":%.9f,"
+               "\"cancel_time\":%.9f",
+            s->nodes, s->pushes, s->pops, s->publishes, s->nodes_published,
+            s->steal_attempts, s->steals,
+            s->remote_steals, s->nodes_stolen, s->steal_time, s->idle_time,
+            s->run_time, s->cancel_time);
+}
+
+//The summary and every thread's counters as one JSON object on one line.
+void dfs_stats_print_json(FILE *f, dfs_search_summary *sum,
+                          dfs_thread_stats *s, int num_threads)
+{
+    dfs_thread_stats total;
+    int i;
+
+    fprintf(f, "{\"layout\":\"%s\",\"mode\":\"%s\",\"size\":%ld,\"threads\":%d,"
+               "\"time\":%.9f,\"found\":%ld,\"queries\":%ld,\"total\":{",
+            sum->layout, sum->mode, sum->size, sum->threads, sum->time, sum->found,
+            sum->queries);
+    dfs_stats_sum(&total, s, num_threads);
+    print_json_counters(f, &total);
+    fprintf(f, "},\"phases\":{\"setup\":%.9f,\"wake\":%.9f,\"search\":%.9f,\"join\":%.9f}",
+            sum->phases.setup, sum->phases.wake, sum->phases.search, sum->phases.join);
+    fprintf(f, ",\"per_thread\":[");
+    for(i = 0; i < num_threads; i++){
+        fprintf(f, "%s{\"id\":%d,", (i > 0) ? "," : "", i);
+        print_json_counters(f, &s[i]);
+        fprintf(f, "}");
+    }
+    fprintf(f, "]}\n");
+}
@@ -0,0 +1,71 @@
+//Written by David Ells
+//
+//Per thread search counters for dfs-search. Each thread only writes its
+//own dfs_thread_stats, which sits on cache lines of its own, so counting
+//is cheap enough to leave on all the time.
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <time.h>
+#include "deque.h"
+
+typedef struct {
+    _Alignas(DSP_CACHELINE) long nodes;     //nodes visited, leaf block values included
+    long pushes;                            //nodes set aside for later, on the thread's
+                                            //private stack or its deque
+    long pops;                              //nodes taken back off them
+    long publishes;                         //times private work was moved to the deque
+                                            //for a hungry thief
+    long nodes_published;                   //nodes those moves made stealable
+    long steal_attempts;                    //steals tried on a victim's deque
+    long steals;                            //of those, the ones that got work
+    long remote_steals;                     //of those, from another NUMA node
+    long nodes_stolen;                      //nodes those steals moved
+    double steal_time;                      //seconds spent looking for work to steal
+    double idle_time;                       //seconds spent idle waiting for work
+    double run_time;                        //seconds from start to exit of the thread
+    double cancel_time;                     //seconds from the search being cancelled
+                                            //to the thread stopping, 0 if it wasn't
+    double start_stamp;                     //monotonic times the thread started and
+    double stop_stamp;                      //stopped, 0 if it took no part
+} dfs_thread_stats;
+
+//Where the wall clock time of one search went, in seconds.
+typedef struct {
+    double setup;           //handing out the first work, before waking workers
+    double wake;            //until the last worker started
+    double search;          //until the last worker stopped
+    double join;            //until the caller saw them all done
+} dfs_search_phases;
+
+//What the counters are reported along with.
+typedef struct {
+    const char *layout;
+    const char *mode;
+    long size;
+    int threads;
+    double time;
+    long found;             //1 or 0, or distinct values found in batch mode
+    long queries;           //0 unless in batch mode
+    dfs_search_phases phases;
+} dfs_search_summary;
+
+//Monotonic wall clock time in seconds.
+static inline double dfs_stats_now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+}
+
+dfs_thread_stats *dfs_stats_create(int);
+void dfs_stats_reset(dfs_thread_stats *, int);
+void dfs_stats_sum(dfs_thread_stats *, dfs_thread_stats *, int);
+void dfs_stats_phases(dfs_search_phases *, dfs_thread_stats *, int, double, double, double);
+void dfs_stats_print_text(FILE *, dfs_search_summary *, dfs_thread_stats *, int);
+void dfs_stats_print_json(FILE *, dfs_search_summary *, dfs_thread_stats *, int);
+
+#endif
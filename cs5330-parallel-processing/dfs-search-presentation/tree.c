@@ -2,6 +2,7 @@
 //
 //A simple binary tree ADT.
 
+#include <stdlib.h>
 #include "tree.h"
 
 void treenode_init(treenode *n)
@@ -33,6 +34,29 @@ void tree_init(tree *t)
     t->node_count = 0;
 }
 
+//Free every node of t. Random trees run deep, so this walks with a stack
+//of its own instead of recursing. Returns 0, leaving t as it was, if
+//there is no memory for the stack.
+int tree_free(tree *t)
+{
+    treenode **stack, *n;
+    unsigned long sp = 0;
+
+    if(t->head == NULL) return 1;
+    stack = (treenode **)malloc(sizeof(treenode *) * t->node_count);
+    if(stack == NULL) return 0;
+    stack[sp++] = t->head;
+    while(sp > 0){
+        n = stack[--sp];
+        if(n->left != NULL) stack[sp++] = n->left;
+        if(n->right != NULL) stack[sp++] = n->right;
+        free(n);
+    }
+    free(stack);
+    tree_init(t);
+    return 1;
+}
+
 void tree_print_r(treenode *n, FILE *f)
 {
     if(n == NULL) return;
@@ -54,7 +78,35 @@ void tree_visit_r(treenode *n, treenode_func func, void *arg)
     tree_visit_r(n->right, func, arg);
 }
 
-void tree_visit(tree *t, treenode_func fun, void *arg)
+//Call fun on every node of t in the same order as tree_visit_r (node, left
+//subtree, right subtree), but with a stack of right children that grows
+//on the heap, so a degenerate random tree can't overflow the C stack.
+//Returns 0 if there is no memory for the stack, having visited some of t.
+int tree_visit(tree *t, treenode_func fun, void *arg)
 {
-    tree_visit_r(t->head, fun, arg);
+    treenode **stack, **bigger, *n;
+    unsigned long sp = 0, size = 64;
+
+    stack = (treenode **)malloc(sizeof(treenode *) * size);
+    if(stack == NULL) return 0;
+    n = t->head;
+    while(n != NULL || sp > 0){
+        if(n == NULL) n = stack[--sp];
+        (*fun)(n, arg);
+        if(n->right != NULL){
+            if(sp == size){
+                bigger = (treenode **)realloc(stack, sizeof(treenode *) * size * 2);
+                if(bigger == NULL){
+                    free(stack);
+                    return 0;
+                }
+                stack = bigger;
+                size *= 2;
+            }
+            stack[sp++] = n->right;
+        }
+        n = n->left;
+    }
+    free(stack);
+    return 1;
 }
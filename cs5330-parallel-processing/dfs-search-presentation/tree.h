@@ -2,6 +2,9 @@
 //
 //A simple binary tree ADT.
 
+#ifndef TREE_H
+#define TREE_H
+
 #include <stdio.h>
 
 typedef struct treenode {
@@ -22,7 +25,10 @@ void treenode_init(treenode *);
 int treenode_isleaf(treenode *);
 void treenode_print(treenode *, FILE *);
 void tree_init(tree *);
+int tree_free(tree *);
 void tree_print_r(treenode *, FILE *);
 void tree_print(tree *, FILE *);
 void tree_visit_r(treenode *, treenode_func, void *);
-void tree_visit(tree *, treenode_func, void *);
+int tree_visit(tree *, treenode_func, void *);
+
+#endif
@@ -0,0 +1,381 @@
+//Written by David Ells
+//
+//Parallel tree builders. See treebuild.h.
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include "treebuild.h"
+#include "rng.h"
+
+//Shared by the threads of one build. Thread id builds chunk id, which is
+//input positions [n*id/num_chunks, n*(id+1)/num_chunks).
+typedef struct {
+    int num_chunks;
+    int *array;
+    unsigned long n;
+    uint64_t seed;
+    ctree *t;
+    treenode **pnodes;
+    atomic_int failed;
+    uint64_t *sorted;       //sort keys, see etree_sort_key
+    uint64_t *merged;
+    int width;              //chunks per sorted run
+    int subtree_depth;
+    etree *et;
+} build_job;
+
+static void chunk_bounds(build_job *job, int id, uint32_t *lo, uint32_t *hi)
+{
+    *lo = (uint32_t)(job->n * id / job->num_chunks);
+    *hi = (uint32_t)(job->n * (id + 1) / job->num_chunks);
+}
+
+//Never more chunks than threads or input values, never fewer than one.
+static int clamp_chunks(dsp_pool_t *pool, int num_threads, unsigned long n)
+{
+    if(num_threads > pool->num_threads) num_threads = pool->num_threads;
+    if((unsigned long)num_threads > n) num_threads = n;
+    if(num_threads < 1) num_threads = 1;
+    return num_threads;
+}
+
+//Hang node i off a random free link of a random node in [lo, i), which
+//must have at least one free link.
+static void attach_random(ctreenode *nodes, uint32_t lo, uint32_t i, dsp_rng_t *rng)
+{
+    ctreenode *pnode;
+
+    do {
+        pnode = &nodes[lo + dsp_rng_below(rng, i - lo)];
+    } while(pnode->left != CTREE_NIL && pnode->right != CTREE_NIL);
+
+    if(pnode->left == CTREE_NIL && pnode->right == CTREE_NIL){
+        if(dsp_rng_next(rng) >> 63)
+            pnode->right = i;
+        else
+            pnode->left = i;
+    } else if(pnode->left == CTREE_NIL){
+        pnode->left = i;
+    } else {
+        pnode->right = i;
+    }
+}
+
+//Grow a random tree over one chunk, the same way the serial builder does
+//over the whole input: each node picks a random earlier node with a free
+//link as its parent. The chunk's first node is its root.
+static void build_random_chunk(int id, void *arg)
+{
+    build_job *job = (build_job *)arg;
+    ctreenode *nodes = job->t->nodes;
+    dsp_rng_t rng;
+    uint32_t lo, hi, i;
+
+    //Stream 0 is kept for stitching.
+    dsp_rng_seed(&rng, job->seed, id + 1);
+    chunk_bounds(job, id, &lo, &hi);
+    for(i = lo; i < hi; i++){
+        ctreenode_init(&nodes[i], job->array[i]);
+        if(i > lo) attach_random(nodes, lo, i, &rng);
+    }
+}
+
+//Build a random compact tree over the values in array with num_threads
+//threads of pool, in t, whose arena must already be allocated for its
+//node_count values. Chunk c's subtree root is attached to a random free
+//link in chunk (c-1)/2's subtree.
+void treebuild_random_ctree(dsp_pool_t *pool, int num_threads, uint64_t seed,
+                            int *array, ctree *t)
+{
+    build_job job;
+    dsp_rng_t rng;
+    uint32_t lo, hi, plo, phi;
+    ctreenode *pnode;
+    int c;
+
+    if(t->node_count == 0) return;
+
+    job.t = t;
+    job.num_chunks = clamp_chunks(pool, num_threads, t->node_count);
+    job.array = array;
+    job.n = t->node_count;
+    job.seed = seed;
+    dsp_pool_run(pool, job.num_chunks, build_random_chunk, &job);
+
+    //Stitch. A subtree of k nodes has k+1 free links, so the search for a
+    //free one ends quickly.
+    dsp_rng_seed(&rng, seed, 0);
+    for(c = 1; c < job.num_chunks; c++){
+        chunk_bounds(&job, c, &lo, &hi);
+        chunk_bounds(&job, (c - 1) / 2, &plo, &phi);
+        do {
+            pnode = &job.t->nodes[plo + dsp_rng_below(&rng, phi - plo)];
+        } while(pnode->left != CTREE_NIL && pnode->right != CTREE_NIL);
+        if(pnode->left == CTREE_NIL)
+            pnode->left = lo;
+        else
+            pnode->right = lo;
+    }
+    t->head = 0;
+}
+
+static void build_balanced_chunk(int id, void *arg)
+{
+    build_job *job = (build_job *)arg;
+    ctreenode *nodes = job->t->nodes;
+    uint64_t n = job->n;
+    uint32_t lo, hi, i;
+
+    chunk_bounds(job, id, &lo, &hi);
+    for(i = lo; i < hi; i++){
+        ctreenode_init(&nodes[i], job->array[i]);
+        if((uint64_t)2*i + 1 < n) nodes[i].left = 2*i + 1;
+        if((uint64_t)2*i + 2 < n) nodes[i].right = 2*i + 2;
+    }
+}
+
+//Build the balanced compact tree (children of i at 2i+1 and 2i+2) in t,
+//as above, each thread filling in its own chunk.
+void treebuild_balanced_ctree(dsp_pool_t *pool, int num_threads, int *array, ctree *t)
+{
+    build_job job;
+
+    if(t->node_count == 0) return;
+
+    job.t = t;
+    job.num_chunks = clamp_chunks(pool, num_threads, t->node_count);
+    job.array = array;
+    job.n = t->node_count;
+    dsp_pool_run(pool, job.num_chunks, build_balanced_chunk, &job);
+    t->head = 0;
+}
+
+//Make one treenode per value of the chunk. Each thread allocates its own
+//nodes, so they come out of that thread's malloc arena.
+static void alloc_ptree_chunk(int id, void *arg)
+{
+    build_job *job = (build_job *)arg;
+    uint32_t lo, hi, i;
+    treenode *n;
+
+    chunk_bounds(job, id, &lo, &hi);
+    for(i = lo; i < hi; i++){
+        n = (treenode *)malloc(sizeof(treenode));
+        job->pnodes[i] = n;
+        if(n == NULL){
+            atomic_store(&job->failed, 1);
+            continue;
+        }
+        treenode_init(n);
+        n->id = i;
+        n->data = (void *)&job->array[i];
+    }
+}
+
+static void link_ptree_chunk(int id, void *arg)
+{
+    build_job *job = (build_job *)arg;
+    ctreenode *cn;
+    uint32_t lo, hi, i;
+
+    chunk_bounds(job, id, &lo, &hi);
+    for(i = lo; i < hi; i++){
+        cn = &job->t->nodes[i];
+        if(cn->left != CTREE_NIL) job->pnodes[i]->left = job->pnodes[cn->left];
+        if(cn->right != CTREE_NIL) job->pnodes[i]->right = job->pnodes[cn->right];
+    }
+}
+
+static void free_ptree_chunk(int id, void *arg)
+{
+    build_job *job = (build_job *)arg;
+    uint32_t lo, hi, i;
+
+    chunk_bounds(job, id, &lo, &hi);
+    for(i = lo; i < hi; i++){
+        free(job->pnodes[i]);
+    }
+}
+
+//Make a pointer tree with the same shape as the compact tree src, whose
+//node i holds array[i]. src must have no leaf blocks. Returns NULL if
+//memory ran out.
+tree *treebuild_ptree(dsp_pool_t *pool, int num_threads, ctree *src, int *array)
+{
+    build_job job;
+    tree *t;
+
+    t = (tree *)malloc(sizeof(tree));
+    if(t == NULL) return NULL;
+    tree_init(t);
+    t->node_count = src->node_count;
+    if(src->node_count == 0) return t;
+
+    job.pnodes = (treenode **)malloc(sizeof(treenode *) * src->node_count);
+    if(job.pnodes == NULL){
+        free(t);
+        return NULL;
+    }
+    job.num_chunks = clamp_chunks(pool, num_threads, src->node_count);
+    job.array = array;
+    job.n = src->node_count;
+    job.t = src;
+    atomic_init(&job.failed, 0);
+
+    dsp_pool_run(pool, job.num_chunks, alloc_ptree_chunk, &job);
+    if(atomic_load(&job.failed)){
+        dsp_pool_run(pool, job.num_chunks, free_ptree_chunk, &job);
+        free(job.pnodes);
+        free(t);
+        return NULL;
+    }
+    dsp_pool_run(pool, job.num_chunks, link_ptree_chunk, &job);
+
+    t->head = job.pnodes[src->head];
+    free(job.pnodes);
+    return t;
+}
+
+//Values are sorted as one 64 bit key each: the value, with its sign bit
+//flipped so signed order is unsigned order, over the input position.
+static uint64_t etree_sort_key(int value, uint32_t id)
+{
+    return ((uint64_t)((uint32_t)value ^ 0x80000000u) << 32) | id;
+}
+
+//Store the value and id behind a sort key in node k.
+static void etree_put(etree *t, unsigned long k, uint64_t key)
+{
+    t->keys[k] = (int)((uint32_t)(key >> 32) ^ 0x80000000u);
+    t->ids[k] = (uint32_t)key;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static void sort_etree_chunk(int id, void *arg)
+{
+    build_job *job = (build_job *)arg;
+    uint32_t lo, hi, i;
+
+    chunk_bounds(job, id, &lo, &hi);
+    for(i = lo; i < hi; i++){
+        job->sorted[i] = etree_sort_key(job->array[i], i);
+    }
+    qsort(&job->sorted[lo], hi - lo, sizeof(uint64_t), compare_u64);
+}
+
+//Merge the id'th pair of sorted runs of job->width chunks each from sorted
+//into merged. The last run of a round may have no partner.
+static void merge_etree_runs(int id, void *arg)
+{
+    build_job *job = (build_job *)arg;
+    uint64_t *src = job->sorted, *dst = job->merged;
+    uint32_t lo, mid, hi, dummy;
+    uint32_t i, j, k;
+    int a = 2 * id * job->width, b = a + job->width, c = b + job->width;
+
+    if(b > job->num_chunks) b = job->num_chunks;
+    if(c > job->num_chunks) c = job->num_chunks;
+    chunk_bounds(job, a, &lo, &dummy);
+    chunk_bounds(job, b - 1, &dummy, &mid);
+    chunk_bounds(job, c - 1, &dummy, &hi);
+
+    i = lo;
+    j = mid;
+    k = lo;
+    while(i < mid && j < hi){
+        dst[k++] = (src[i] <= src[j]) ? src[i++] : src[j++];
+    }
+    memcpy(&dst[k], &src[i], sizeof(uint64_t) * (mid - i));
+    k += mid - i;
+    memcpy(&dst[k], &src[j], sizeof(uint64_t) * (hi - j));
+}
+
+//Nodes in order before the subtree under node k.
+static unsigned long etree_subtree_start(unsigned long n, unsigned long k)
+{
+    unsigned long start = 0;
+
+    for(; k > 1; k >>= 1){
+        if(k & 1) start += etree_subtree_size(n, k - 1) + 1;
+    }
+    return start;
+}
+
+static void fill_etree_r(etree *t, uint64_t *sorted, unsigned long k, unsigned long *rank)
+{
+    if(k > t->node_count) return;
+    fill_etree_r(t, sorted, 2 * k, rank);
+    etree_put(t, k, sorted[(*rank)++]);
+    fill_etree_r(t, sorted, 2 * k + 1, rank);
+}
+
+//Fill every subtree rooted at job->subtree_depth whose root is id mod
+//job->num_chunks.
+static void fill_etree_chunk(int id, void *arg)
+{
+    build_job *job = (build_job *)arg;
+    unsigned long k, rank;
+    unsigned long first = 1UL << job->subtree_depth;
+
+    for(k = first + id; k < 2 * first && k <= job->n; k += job->num_chunks){
+        rank = etree_subtree_start(job->n, k);
+        fill_etree_r(job->et, job->sorted, k, &rank);
+    }
+}
+
+//Bulk load the sorted index t over the n values in array with num_threads
+//threads of pool. Returns 0 if memory ran out.
+int treebuild_etree(dsp_pool_t *pool, int num_threads, int *array, unsigned long n,
+                    etree *t)
+{
+    build_job job;
+    uint64_t *tmp;
+    unsigned long k, rank;
+
+    if(!etree_alloc(t, n)) return 0;
+    if(n == 0) return 1;
+
+    job.sorted = (uint64_t *)malloc(sizeof(uint64_t) * n);
+    job.merged = (uint64_t *)malloc(sizeof(uint64_t) * n);
+    if(job.sorted == NULL || job.merged == NULL){
+        free(job.sorted);
+        free(job.merged);
+        etree_free(t);
+        return 0;
+    }
+    job.num_chunks = clamp_chunks(pool, num_threads, n);
+    job.array = array;
+    job.n = n;
+    job.et = t;
+
+    dsp_pool_run(pool, job.num_chunks, sort_etree_chunk, &job);
+    for(job.width = 1; job.width < job.num_chunks; job.width *= 2){
+        dsp_pool_run(pool, (job.num_chunks + 2 * job.width - 1) / (2 * job.width),
+                     merge_etree_runs, &job);
+        tmp = job.sorted;
+        job.sorted = job.merged;
+        job.merged = tmp;
+    }
+
+    //A few subtrees per thread, for balance; the levels above them are
+    //filled here.
+    for(job.subtree_depth = 0; (1L << job.subtree_depth) < 4L * job.num_chunks;
+        job.subtree_depth++);
+    for(k = 1; k < (1UL << job.subtree_depth) && k <= n; k++){
+        rank = etree_subtree_start(n, k) + etree_subtree_size(n, 2 * k);
+        etree_put(t, k, job.sorted[rank]);
+    }
+    dsp_pool_run(pool, job.num_chunks, fill_etree_chunk, &job);
+
+    free(job.sorted);
+    free(job.merged);
+    return 1;
+}
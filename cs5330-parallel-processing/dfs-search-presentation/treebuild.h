@@ -0,0 +1,31 @@
+//Written by David Ells
+//
+//Parallel tree builders for dfs-search, run on a pool of worker threads.
+//The input is cut into one contiguous chunk per thread. For the random
+//tree, each chunk grows its own random subtree with its own RNG stream,
+//and the chunk subtrees are then hung off each other in a balanced
+//pattern. The tree built depends only on the seed, the input and the
+//number of threads, not on thread timing. Node ids are input positions,
+//as in the serial builders.
+//
+//The sorted index is bulk loaded the same way: each thread sorts its
+//chunk, sorted runs are merged pairwise in parallel rounds, and the
+//Eytzinger array is filled one subtree per task, each subtree knowing
+//from its position where its keys start in the sorted run. The result
+//is the same for any number of threads.
+
+#ifndef TREEBUILD_H
+#define TREEBUILD_H
+
+#include <stdint.h>
+#include "tree.h"
+#include "ctree.h"
+#include "etree.h"
+#include "pool.h"
+
+void treebuild_random_ctree(dsp_pool_t *, int, uint64_t, int *, ctree *);
+void treebuild_balanced_ctree(dsp_pool_t *, int, int *, ctree *);
+tree *treebuild_ptree(dsp_pool_t *, int, ctree *, int *);
+int treebuild_etree(dsp_pool_t *, int, int *, unsigned long, etree *);
+
+#endif
@@ -0,0 +1,80 @@
+//Written by David Ells
+//
+//A set of distinct int values. See valset.h.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "valset.h"
+
+//Fibonacci hashing: the top bits of value * 2^32/phi.
+static unsigned long valset_hash(dsp_valset_t *s, int value)
+{
+    return (uint32_t)((uint32_t)value * 2654435769u) >> s->shift;
+}
+
+//Size the table for up to max_values values at most half full.
+//Returns 1 on success, 0 if memory ran out.
+int dsp_valset_init(dsp_valset_t *s, unsigned long max_values)
+{
+    unsigned long size = 16;
+    int bits = 4;
+
+    while(size < max_values * 2){
+        size *= 2;
+        bits++;
+    }
+    s->keys = (int *)malloc(sizeof(int) * size);
+    s->used = (unsigned char *)calloc(size, 1);
+    if(s->keys == NULL || s->used == NULL){
+        free(s->keys);
+        free(s->used);
+        return 0;
+    }
+    s->mask = size - 1;
+    s->count = 0;
+    s->shift = 32 - bits;
+    return 1;
+}
+
+void dsp_valset_destroy(dsp_valset_t *s)
+{
+    free(s->keys);
+    free(s->used);
+    s->keys = NULL;
+    s->used = NULL;
+}
+
+//Returns the slot of value, adding it if it is not already there, or -1
+//if the set is full.
+long dsp_valset_insert(dsp_valset_t *s, int value)
+{
+    unsigned long i = valset_hash(s, value);
+
+    while(s->used[i]){
+        if(s->keys[i] == value) return i;
+        i = (i + 1) & s->mask;
+    }
+    if((s->count + 1) * 2 > s->mask + 1) return -1;
+    s->used[i] = 1;
+    s->keys[i] = value;
+    s->count++;
+    return i;
+}
+
+//Returns the slot of value, or -1 if it is not in the set.
+long dsp_valset_find(dsp_valset_t *s, int value)
+{
+    unsigned long i = valset_hash(s, value);
+
+    while(s->used[i]){
+        if(s->keys[i] == value) return i;
+        i = (i + 1) & s->mask;
+    }
+    return -1;
+}
+
+//Number of slots, for sizing per slot arrays.
+unsigned long dsp_valset_slots(dsp_valset_t *s)
+{
+    return s->mask + 1;
+}
@@ -0,0 +1,24 @@
+//Written by David Ells
+//
+//A set of distinct int values, kept in an open addressing hash table with
+//linear probing. Each value gets a fixed slot number once inserted, which
+//callers can use to index their own per value arrays.
+
+#ifndef VALSET_H
+#define VALSET_H
+
+typedef struct {
+    int *keys;
+    unsigned char *used;
+    unsigned long mask;     //table size - 1, size is a power of two
+    unsigned long count;
+    int shift;
+} dsp_valset_t;
+
+int dsp_valset_init(dsp_valset_t *, unsigned long);
+void dsp_valset_destroy(dsp_valset_t *);
+long dsp_valset_insert(dsp_valset_t *, int);
+long dsp_valset_find(dsp_valset_t *, int);
+unsigned long dsp_valset_slots(dsp_valset_t *);
+
+#endif